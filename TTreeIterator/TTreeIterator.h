@@ -8,10 +8,29 @@
 #include <vector>
 #include <iterator>
 #include <utility>
+#include <type_traits>
+#include <new>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <map>
+#include <ctime>
+#include <iosfwd>
+#ifdef USE_TIMING_PROBES
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #include "TTree.h"
+#include "Compression.h"
 
 class TDirectory;
+class TLeaf;
 
 // define some different implementation methods to compare for speed:
 //#define FEWER_CHECKS 1             // skip sanity/debug checks on every entry
@@ -19,9 +38,14 @@ class TDirectory;
 //#define OVERRIDE_BRANCH_ADDRESS 1  // override any other user SetBranchAddress settings
 //#define PREFER_PTRPTR 1            // for filling ROOT objects, tree->Branch() uses **obj, rather than *obj
 //#define NO_FILL_UNSET_DEFAULT 1    // don't set default values if unset
-//#define NO_BranchValue_STATS 1     // Don't keep stats for optimised BranchValue lookup. Otherwise, prints in ~TTreeIterator::Entry_iterator if verbose.
+//#define NO_BranchValue_STATS 1     // Don't keep read stats (see GetStats). Otherwise, totals are printed in ~TTreeIterator if verbose.
+//#define USE_TIMING_PROBES 1        // histogram the time taken by each lookup, branch read, LoadTree, Fill, and Write (see PrintProbes)
+//#define NO_BranchValue_SCALAR 1    // store fundamental types (double, int, etc) in the any, rather than directly in the BranchValue
+//#define NO_BranchValue_POOL 1      // store large types on the any's heap, rather than in the TTreeIterator's per-type value pools
+//#define USE_VALUE_ARENA 1          // store all branch values together, in the order they were first accessed, in one arena per TTreeIterator
 //#define USE_std_any 1              // use C++17's std::any, instead of Cpp11::any from detail/Cpp11_any.h
 //#define Cpp11_any_NOOPT 1          // don't use Cpp11::any's optimisations (eg. removing error checking)
+//#define Cpp11_any_BUFSIZE 24       // store values up to this size inside Cpp11::any, rather than on the heap (default sizeof(void*))
 //#define NO_DICT 1                  // don't create TTreeIterator dictionary
 
 #if defined(USE_std_any) && (__cplusplus < 201703L)   // <version> not available until GCC9, so no way to check __cpp_lib_any without including <any>.
@@ -43,6 +67,9 @@ namespace any_namespace = ::std;
 #else
 namespace any_namespace = Cpp11;
 #endif
+#if !defined(USE_std_any) && !defined(Cpp11_any_BUFSIZE)
+# define Cpp11_any_BUFSIZE sizeof(void*)
+#endif
 
 
 #include "TTreeIterator/detail/TTreeIterator_helpers.h"
@@ -51,9 +78,9 @@ class TTreeIterator : public TNamed {
 public:
 
 #ifndef USE_std_any
-  using any_type = any_namespace::any;
+  using any_type = any_namespace::basic_any<Cpp11_any_BUFSIZE>;
   using type_code_t = any_namespace::any_type_code;
-  template<typename T> static constexpr type_code_t type_code() { return any_namespace::type_code<T>(); }
+  template<typename T> static constexpr type_code_t type_code() { return any_type::type_code<T>(); }
 #else
   using any_type = std::any;
   using type_code_t = std::size_t;
@@ -64,6 +91,140 @@ public:
   class Entry_iterator;
   class Fill_iterator;
 
+protected:
+  // Fundamental types that BranchValue stores in its Scalar union, rather than in an any.
+#ifndef NO_BranchValue_SCALAR
+  template<typename T> struct is_scalar_value : std::integral_constant<bool, std::is_arithmetic<T>::value && sizeof(T) <= sizeof(Long64_t)> {};
+#else
+  template<typename T> struct is_scalar_value : std::false_type {};
+#endif
+
+  // Types too large for the any's internal buffer, which BranchValue stores in a ValuePool.
+#if !defined(NO_BranchValue_POOL) && !defined(USE_std_any)
+  template<typename T> struct is_pooled_value : std::integral_constant<bool, !is_scalar_value<T>::value && !any_type::is_inline<T>()> {};
+#else
+  template<typename T> struct is_pooled_value : std::false_type {};
+#endif
+
+  // Tags to select how BranchValue stores a value of type T
+  using store_any    = std::integral_constant<int,0>;
+  using store_scalar = std::integral_constant<int,1>;
+  using store_pool   = std::integral_constant<int,2>;
+#ifndef USE_VALUE_ARENA
+  template<typename T> using value_storage = std::integral_constant<int, is_scalar_value<T>::value ? store_scalar::value :
+                                                                         is_pooled_value<T>::value ? store_pool::value   :
+                                                                                                     store_any::value>;
+#else
+  template<typename T> using value_storage = store_pool;   // everything is in the ValueArena
+#endif
+
+  // Values of one type, allocated in chunks so they are contiguous and keep their addresses.
+  // They are all destroyed with the TTreeIterator.
+  class ValuePoolBase {
+  public:
+    virtual ~ValuePoolBase() = default;
+  };
+
+  // A single value, eg. a TTreeIterator's default_value<T>().
+  template <typename T>
+  class ValueHolder : public ValuePoolBase {
+  public:
+    ValueHolder() : fValue(type_default<T>()) {}
+    T fValue;
+  };
+
+  template <typename T>
+  class ValuePool : public ValuePoolBase {
+  public:
+    ValuePool() = default;
+    ValuePool            (const ValuePool&) = delete;
+    ValuePool& operator= (const ValuePool&) = delete;
+    ~ValuePool() override { for (size_t i = 0; i < fSize; ++i) Slot(i)->~T(); }
+    template <typename... Args> T* Create (Args&&... args) {
+      if (fSize == fChunks.size() * kChunkSize) fChunks.emplace_back (new Storage[kChunkSize]);
+      T* pvalue = ::new (static_cast<void*>(Slot(fSize))) T(std::forward<Args>(args)...);
+      ++fSize;
+      return pvalue;
+    }
+    size_t size() const { return fSize; }
+  private:
+    enum { kChunkSize = 16 };
+    using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+    T* Slot (size_t i) const { return reinterpret_cast<T*>(&fChunks[i/kChunkSize][i%kChunkSize]); }
+    std::vector<std::unique_ptr<Storage[]>> fChunks;
+    size_t fSize = 0;
+  };
+
+  // Values of all types, placed one after the other in aligned chunks in the order they are created.
+  // Trivially copyable values are kept separately from the others, so they can be saved and restored with memcpy.
+  class ValueArena {
+  public:
+    ValueArena() = default;
+    ValueArena            (const ValueArena&) = delete;
+    ValueArena& operator= (const ValueArena&) = delete;
+    ~ValueArena() { for (auto it = fDestroy.rbegin(); it != fDestroy.rend(); ++it) (*it->second) (it->first); }
+    template <typename T, typename... Args> T* Create (Args&&... args) {
+      Region& region = std::is_trivially_copyable<T>::value ? fPod : fObj;
+      T* pvalue = ::new (region.Allocate (sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      if (!std::is_trivially_destructible<T>::value) fDestroy.emplace_back (pvalue, &Destroy<T>);
+      return pvalue;
+    }
+    size_t size()    const { return fPod.size() + fObj.size(); }
+    size_t PodSize() const { return fPod.size(); }
+    void SavePod    (      std::vector<char>& buf) const { fPod.Save    (buf); }
+    bool RestorePod (const std::vector<char>& buf)       { return fPod.Restore (buf); }
+  private:
+    struct Chunk {
+      std::unique_ptr<std::max_align_t[]> fData;
+      size_t fCapacity, fUsed;
+      char* data() const { return reinterpret_cast<char*>(fData.get()); }
+    };
+    class Region {
+    public:
+      void* Allocate (size_t size, size_t align) {
+        if (!fChunks.empty()) {
+          Chunk& c = fChunks.back();
+          size_t offset = Align (c, align);
+          if (offset + size <= c.fCapacity) { c.fUsed = offset + size; return c.data() + offset; }
+        }
+        size_t cap = size + align > size_t(kChunkBytes) ? size + align : size_t(kChunkBytes);
+        size_t n = (cap + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+        fChunks.push_back (Chunk{std::unique_ptr<std::max_align_t[]>(new std::max_align_t[n]), n*sizeof(std::max_align_t), 0});
+        Chunk& c = fChunks.back();
+        size_t offset = Align (c, align);
+        c.fUsed = offset + size;
+        return c.data() + offset;
+      }
+      size_t size() const { size_t n = 0; for (auto& c : fChunks) n += c.fUsed; return n; }
+      void Save (std::vector<char>& buf) const {
+        buf.resize (size());
+        char* p = buf.data();
+        for (auto& c : fChunks) { std::memcpy (p, c.data(), c.fUsed); p += c.fUsed; }
+      }
+      bool Restore (const std::vector<char>& buf) {
+        if (buf.size() != size()) return false;
+        const char* p = buf.data();
+        for (auto& c : fChunks) { std::memcpy (c.data(), p, c.fUsed); p += c.fUsed; }
+        return true;
+      }
+    private:
+      enum { kChunkBytes = 16384 };
+      static size_t Align (const Chunk& c, size_t align) {
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(c.data()) + c.fUsed;
+        return c.fUsed + ((align - addr % align) % align);
+      }
+      std::vector<Chunk> fChunks;
+    };
+    template <typename T> static void Destroy (void* p) { static_cast<T*>(p)->~T(); }
+    Region fPod, fObj;
+    std::vector<std::pair<void*,void(*)(void*)>> fDestroy;
+  };
+
+  template <typename T> ValuePool<T>& GetValuePool() const;
+  template <typename T, typename... Args> T* CreateValue (Args&&... args) const;
+
+public:
+
   // ===========================================================================
   class BranchValue {
   public:
@@ -73,7 +234,7 @@ public:
     type_code_t        GetType()       const { return fType; }
 
     // Get value, returning a reference
-    template <typename T> T& Get() const { return Get<T>(default_value<remove_cvref_t<T>>()); }
+    template <typename T> T& Get() const;
 
     // Get() allowing the default value (returned if there is an error) to be specified.
     template <typename T> const T& Get (const T& def) const;
@@ -81,6 +242,9 @@ public:
 
     template <typename T> const T& Set (T&&      val);
 
+    // Return a reference to the branch's own value, to be modified in place.
+    template <typename T>       T& Modify();
+
     int              verbose() const { return tree().verbose(); }
     TTreeIterator&   tree()    const { return fTreeI;           }
     TTree*           GetTree() const { return tree().GetTree(); }
@@ -88,6 +252,7 @@ public:
     // function pointer definition to allow access to templated code
     typedef bool (*SetValueAddress_t) (BranchValue* ibranch, bool redo);
     typedef void (*SetDefaultValue_t) (BranchValue* ibranch);
+    typedef BranchValue* (*CloneBranch_t) (const BranchValue& from, TTreeIterator& tree);
 
     // not called by user, but needs to be public so can be called by std::vector::emplace_back()
     template <typename T> BranchValue (TTreeIterator& tree, const char* name, T&& value);
@@ -107,11 +272,55 @@ public:
     friend Entry_iterator;
     friend Fill_iterator;
 
-    template <typename T>       T& SetValue(T&& value) { return fValue.emplace<T>(std::forward<T>(value)); }
-    template <typename T> const T& GetValue()    const { return any_namespace::any_cast<T&>(fValue); }
-    template <typename T>       T& GetValue()          { return any_namespace::any_cast<T&>(fValue); }
-    template <typename T> const T* GetValuePtr() const { return any_namespace::any_cast<T>(&fValue); }
-    template <typename T>       T* GetValuePtr()       { return any_namespace::any_cast<T>(&fValue); }
+    template <typename T>       T& SetValue(T&& value) { return SetValue<T>(std::forward<T>(value), value_storage<remove_cvref_t<T>>()); }
+    template <typename T> const T& GetValue()    const { return GetValue<T>(value_storage<remove_cvref_t<T>>()); }
+    template <typename T>       T& GetValue()          { return GetValue<T>(value_storage<remove_cvref_t<T>>()); }
+    template <typename T> const T* GetValuePtr() const { return GetValuePtr<T>(value_storage<T>()); }
+    template <typename T>       T* GetValuePtr()       { return GetValuePtr<T>(value_storage<T>()); }
+
+    // small class types are held in the any
+    template <typename T>       T& SetValue(T&& value, store_any) { return fValue.emplace<T>(std::forward<T>(value)); }
+    template <typename T>       T& GetValue   (store_any) const { return any_namespace::any_cast<T&>(const_cast<any_type&>(fValue)); }
+    template <typename T>       T* GetValuePtr(store_any) const { return any_namespace::any_cast<T>(const_cast<any_type*>(&fValue)); }
+
+    // fundamental types are held in fScalar, tagged by fType
+    template <typename T>       T& SetValue(T&& value, store_scalar) {
+      using V = remove_cvref_t<T>;
+      return *::new (static_cast<void*>(&fScalar)) V(std::forward<T>(value));
+    }
+    template <typename T>       T& GetValue   (store_scalar) const { return *GetValuePtr<remove_cvref_t<T>>(store_scalar()); }
+    template <typename T>       T* GetValuePtr(store_scalar) const {
+#ifndef FEWER_CHECKS
+      if (fType != type_code<T>()) return nullptr;
+#endif
+      return reinterpret_cast<T*>(const_cast<Scalar*>(&fScalar));
+    }
+
+    // large types are held in the TTreeIterator's ValuePool<T> (or all types in its ValueArena). A new value reuses the same slot.
+    template <typename T>       T& SetValue(T&& value, store_pool) {
+      using V = remove_cvref_t<T>;
+      if (V* pvalue = static_cast<V*>(fPooled))
+        return ReplaceValue (pvalue, std::forward<T>(value), std::is_assignable<V&,T&&>());
+      V* pvalue = tree().CreateValue<V> (std::forward<T>(value));
+      fPooled = pvalue;
+      return *pvalue;
+    }
+    template <typename V, typename T> static V& ReplaceValue (V* pvalue, T&& value, std::true_type) {
+      *pvalue = std::forward<T>(value);
+      return *pvalue;
+    }
+    template <typename V, typename T> static V& ReplaceValue (V* pvalue, T&& value, std::false_type) {
+      V tmp (std::forward<T>(value));   // if this throws, the slot still holds the old value
+      pvalue->~V();
+      return *::new (static_cast<void*>(pvalue)) V(std::move(tmp));
+    }
+    template <typename T>       T& GetValue   (store_pool) const { return *GetValuePtr<remove_cvref_t<T>>(store_pool()); }
+    template <typename T>       T* GetValuePtr(store_pool) const {
+#ifndef FEWER_CHECKS
+      if (fType != type_code<T>()) return nullptr;
+#endif
+      return static_cast<T*>(fPooled);
+    }
 
     template <typename T> void     CreateBranch       (const char* leaflist, Int_t bufsize, Int_t splitlevel);
     template <typename T> const T* GetBranchValue() const;
@@ -119,6 +328,7 @@ public:
 
     template <typename T> static void SetDefaultValue (BranchValue* ibranch);
     template <typename T> static bool SetValueAddress (BranchValue* ibranch, bool redo=false);
+    template <typename T> static BranchValue* CloneBranch (const BranchValue& from, TTreeIterator& tree);
 
 #ifdef USE_TTREE_GETENTRY
     void  Enable()      { if ( (fWasDisabled = fBranch->TestBit(kDoNotProcess))) SetBranchStatus ( true); }
@@ -128,11 +338,20 @@ public:
     void SetBranchStatus (bool status=true) { TTreeIterator::SetBranchStatus (fBranch, status, true, verbose()); }
 #endif
     Int_t GetBranch (Long64_t index, Long64_t localIndex) const;
+    void SetBranch (TBranch* branch);
     void ResetAddress();
 
+    // Variant storage for the fundamental types: fType says which member is in use.
+    union Scalar {
+      Bool_t o; Char_t b; UChar_t B; Short_t S; UShort_t s; Int_t I; UInt_t i;
+      Long_t G; ULong_t g; Long64_t L; ULong64_t l; Float_t F; Double_t D;
+    };
+
     std::string       fName;
     type_code_t       fType;
     any_type          fValue;
+    Scalar            fScalar  = {};
+    void*             fPooled  = nullptr;   // value in ValuePool or ValueArena, owned by fTreeI
     mutable void*     fPvalue   = nullptr;
 #ifndef OVERRIDE_BRANCH_ADDRESS
     mutable void**    fPuser    = nullptr;
@@ -146,9 +365,14 @@ public:
 #endif
     SetDefaultValue_t fSetDefaultValue;    // function to set value to the default
     SetValueAddress_t fSetValueAddress;    // function to set the address again
+    CloneBranch_t     fCloneBranch;        // function to copy this branch into another thread's TTreeIterator
     bool              fHaveAddr = false;
     bool              fUnset    = false;
     bool              fIsObj    = false;
+    bool              fIsFriend = false;    // fBranch is in a friend tree, so has its own entry number
+#ifdef USE_VALUE_ARENA
+    bool              fIsPod    = false;    // value is in the ValueArena's trivially-copyable region
+#endif
   };
 
   // ===========================================================================
@@ -207,6 +431,25 @@ public:
     template <typename T> const T& operator= (T&& val) { return const_cast<Entry&>(fEntry).Set<T>(fName, std::forward<T>(val)); }
   };
 
+  // ===========================================================================
+  // Type of a branch to be created up-front by FillEntries(n,schema), as returned by TTreeIterator::type<T>().
+  class BranchType {
+  public:
+    typedef TBranch* (*Create_t) (TTreeIterator& tree, const char* name, Long64_t index, const BranchType& type);
+    BranchType (type_code_t type, Create_t create, const char* leaflist=nullptr, Int_t bufsize=-1, Int_t splitlevel=-1)
+      : fType(type), fCreate(create), fLeaflist(leaflist ? leaflist : ""), fBufsize(bufsize), fSplitlevel(splitlevel) {}
+    TBranch* CreateBranch (TTreeIterator& tree, const char* name, Long64_t index) const { return (*fCreate) (tree, name, index, *this); }
+
+    type_code_t fType;
+    Create_t    fCreate;
+    std::string fLeaflist;     // copied: GetLeaflist<T>() may return a temporary Form() buffer
+    Int_t       fBufsize;      // -1 = use TTreeIterator's setting
+    Int_t       fSplitlevel;   // -1 = use TTreeIterator's setting
+  };
+
+  // List of (branch name, type) pairs, eg. Schema{{"x",type<double>()}, {"M",type<MyStruct>()}}
+  using Schema = std::vector<std::pair<std::string,BranchType>>;
+
   // ===========================================================================
   class Entry {
   public:
@@ -227,7 +470,11 @@ public:
     Setter operator[] (const char* name)       { return Setter(*this,name); }   // Setter can also do Get for non-const this
 
     // Get value, returning a reference
-    template <typename T> T& Get(const char* name) const { return const_cast<T&> (Get<T>(name, default_value<remove_cvref_t<T>>())); }
+    template <typename T> T& Get(const char* name) const;
+
+    // Get a copy of the value, for small trivially-copyable types (eg. double, int).
+    // Returns type_default<T>() if there is an error, so doesn't need the TTreeIterator's default_value<T>().
+    template <typename T> T Value(const char* name) const;
 
     // Get() allowing the default value (returned if there is an error) to be specified.
     template <typename T> T& Get(const char* name, T& val) const { return const_cast<T&> (Get<T> (name, const_cast<const T&>(val))); }
@@ -251,6 +498,22 @@ public:
     template <typename T>
     const T& Set(const char* name, T&& val, const char* leaflist, Int_t bufsize, Int_t splitlevel);
 
+    // Modify() returns a reference to the branch's own buffer (creating the branch if necessary),
+    // so the value can be updated in place for this entry. Containers filled this way keep their
+    // capacity from entry to entry, so do not need to reallocate.
+    template <typename T>
+    T& Modify(const char* name) {
+      return Modify<T> (name, GetLeaflist<T>(), tree().fBufsize, tree().fSplitlevel);
+    }
+
+    template <typename T>
+    T& Modify(const char* name, const char* leaflist, Int_t bufsize, Int_t splitlevel);
+
+    // Set the value of the branch at position ibranch in the BranchValue cache.
+    // With FillEntries(n,schema), this is the branch's position in the schema.
+    template <typename T>
+    const T& SetAt(std::size_t ibranch, T&& val);
+
     Int_t GetEntry (Int_t getall=0) { Int_t nb = tree().GetEntry (fIndex, getall); fLocalIndex = GetTree()->GetReadEntry(); return nb; }
     Int_t Fill() { Int_t nbytes = tree().Fill(); if (nbytes > 0) fWriting = true; return nbytes; }
 
@@ -270,7 +533,15 @@ public:
       return Branch<T> (name, leaflist, bufsize, splitlevel);
     }
 
-    Entry& LoadTree (Long64_t index) { fIndex = index; fLocalIndex = GetTree()->LoadTree (index); return *this; }
+    Entry& LoadTree (Long64_t index) {
+#ifdef USE_TIMING_PROBES
+      ProbeScope probe (tree().fProbes[kProbeLoadTree]);
+#endif
+      fIndex = index;
+      fLocalIndex = GetTree()->LoadTree (index);
+      if (GetTree()->GetTreeNumber() != tree().fTreeNumber) tree().TreeChanged();   // TChain moved to another file
+      return *this;
+    }
 
     BranchValue_iterator begin() const { return BranchValue_iterator (*this, 0);                       }
     BranchValue_iterator end()   const { return BranchValue_iterator (*this, tree().fBranches.size()); }
@@ -306,12 +577,12 @@ public:
 //  Entry_iterator (const Entry_iterator& in) : fIndex(in.fIndex), fEnd(in.fEnd), fTreeI(in.fTreeI) {}  // default probably OK
     Entry_iterator& operator++() { ++fIndex; return *this; }
     Entry_iterator  operator++(int) { Entry_iterator it = *this; ++fIndex; return it; }
-    bool operator!= (const Entry_iterator& other) const { return fIndex != other.fIndex; }
-    bool operator== (const Entry_iterator& other) const { return fIndex == other.fIndex; }
+    bool operator!= (const Entry_iterator& other) const { return fIndex != other.fIndex && !(other.fIndex == kLazyEnd && AtEnd()); }
+    bool operator== (const Entry_iterator& other) const { return !(*this != other); }
 #ifdef USE_TTREE_GETENTRY
-    const Entry& operator*() const { fEntry.fIndex = fIndex < fEnd ? fIndex : -1; fEntry.GetEntry(); return fEntry; }
+    const Entry& operator*() const { CountEntry(); fEntry.fIndex = fIndex < fEnd ? fIndex : -1; fEntry.GetEntry(); return fEntry; }
 #else
-    const Entry& operator*() const { return fEntry.LoadTree (fIndex < fEnd ? fIndex : -1); }
+    const Entry& operator*() const { CountEntry(); return fEntry.LoadTree (fIndex < fEnd ? fIndex : -1); }
 #endif
     Long64_t last() { return fEnd; }
 
@@ -321,12 +592,38 @@ public:
     TTreeIterator&  tree()    const { return fTreeI;           }
     TTree*          GetTree() const { return fTreeI.GetTree(); }
 
+    // end() sentinel in lazy mode (see SetLazy)
+    static constexpr Long64_t kLazyEnd = TTree::kMaxEntries;
+
   protected:
     friend BranchValue;
     friend Entry;
 
+    // For the lazy end(), check whether we are past the last entry, only looking again when we pass the end of the current file.
+    // Though const, this may load the next file of a TChain (see KnownEntries) when its entry count isn't known yet.
+    bool AtEnd() const {
+      if (fIndex < fKnown) return false;
+      fKnown = fTreeI.KnownEntries (fIndex);
+      return fIndex >= fKnown;
+    }
+
+    void CountEntry() const {
+#ifndef NO_BranchValue_STATS
+      ++fTreeI.fNentries;
+      if (fTreeI.fStatsTiming) {
+        double now = ClockSeconds();
+        if (fLastClock > 0.0) fTreeI.fLoopSeconds += now - fLastClock;
+        fLastClock = now;
+      }
+#endif
+    }
+
     Long64_t fIndex;
     const Long64_t fEnd;
+    mutable Long64_t fKnown = 0;   // entries before this are known to exist
+#ifndef NO_BranchValue_STATS
+    mutable double fLastClock = 0.0;   // when the last entry was loaded
+#endif
     TTreeIterator& fTreeI;
     mutable Entry fEntry;   // local copy so we can return it by reference
   };
@@ -402,6 +699,43 @@ public:
   Int_t           GetBufsize()               const  { return       fBufsize;                    }
   TTreeIterator&  SetSplitlevel (Int_t splitlevel)  { fSplitlevel = splitlevel;   return *this; }
   Int_t           GetSplitlevel()            const  { return       fSplitlevel;                 }
+  TTreeIterator&  SetAutoFlush  (Long64_t autof)    { fAutoFlush  = autof;        return *this; }   // passed to TTree::SetAutoFlush by FillEntries (0 = TTree default)
+  Long64_t        GetAutoFlush()             const  { return       fAutoFlush;                  }
+  // Basket tuning mode: after the first cluster has been flushed, resize each branch's baskets from
+  // its observed compressed size, keeping the total within maxMemory bytes (0 = no tuning).
+  // Unless SetAutoFlush is also specified, the cluster size is chosen to fit the same budget.
+  TTreeIterator&  SetOptimizeBaskets (Long64_t maxMemory) { fOptimizeBaskets = maxMemory; return *this; }
+  Long64_t        GetOptimizeBaskets()       const  { return       fOptimizeBaskets;            }
+  // Compression policy for new branches whose names match the wildcard pattern (eg. "jet_*").
+  // The last matching pattern is used. Branches that don't match any pattern use the file's setting.
+  TTreeIterator&  SetCompression (const char* pattern, ROOT::RCompressionSetting::EAlgorithm::EValues algorithm, int level) {
+    return SetCompressionSettings (pattern, ROOT::CompressionSettings (algorithm, level));
+  }
+  TTreeIterator&  SetCompressionSettings (const char* pattern, int settings) { fCompression.emplace_back (pattern, settings); return *this; }
+  int             GetCompressionSettings (const char* name) const;   // -1 if no pattern matches
+  void            ClearCompression()                { fCompression.clear(); }
+  // Checkpoint a long fill every nentries entries, nbytes filled bytes, or seconds of wall time, whichever comes first
+  // (0 = no limit). A checkpoint flushes the baskets to the file, bounding their memory use, and if autosave
+  // also saves the tree header so the file can be recovered after a crash.
+  TTreeIterator&  SetCheckpoint (Long64_t nentries, Long64_t nbytes=0, double seconds=0.0, bool autosave=true) {
+    fCheckpointEntries = nentries; fCheckpointBytes = nbytes; fCheckpointSeconds = seconds; fCheckpointAutoSave = autosave;
+    return *this;
+  }
+  // For a TChain, don't open every file to count the entries when starting the loop: end() is a sentinel,
+  // and we look for the end of the chain as each file is opened.
+  TTreeIterator&  SetLazy (bool lazy)               { fLazy       = lazy;         return *this; }
+  bool            GetLazy()                  const  { return       fLazy;                       }
+  // Sidecar file caching each chain file's entry count, checked against the file's size and modification time.
+  // Add() uses the cached count, so the file doesn't have to be opened until it is read. Counts found while
+  // reading the chain are saved in the cache when the TTreeIterator is deleted (or by SaveEntriesCache).
+  // This should be set before calling Add(). Returns false if the cache file exists, but can't be read.
+  bool            SetEntriesCache (const char* fname);
+  bool            SaveEntriesCache() const;
+  // When reading a TChain, start opening the next file (TFile::AsyncOpen) as soon as we move to a new file.
+  // This only helps for remote files (eg. root://) whose open latency is significant, so is off by default.
+  // If we don't go on to read that file, the open is completed and the file closed when we move elsewhere.
+  TTreeIterator&  SetAsyncOpen (bool async)         { fAsyncOpen  = async;        return *this; }
+  bool            GetAsyncOpen()             const  { return       fAsyncOpen;                  }
 #ifndef OVERRIDE_BRANCH_ADDRESS  // only need flag if compiled in
   TTreeIterator&  SetOverrideBranchAddress (bool o) { fOverrideBranchAddress = o; return *this; }
   bool            GetOverrideBranchAddress() const  { return fOverrideBranchAddress;            }
@@ -413,20 +747,172 @@ public:
   std::string BranchNamesString (bool include_children=true, bool include_inactive=false);
   std::vector<std::string> BranchNames (bool include_children=false, bool include_inactive=false);
 
+#ifdef USE_VALUE_ARENA
+  // Copy the values of all trivially-copyable branches (as last read or set) to buf, or back again, with memcpy.
+  // RestoreValues fails if branches have been added since SaveValues. Restored branches count as set for Fill().
+  void SaveValues    (      std::vector<char>& buf) const { fValueArena.SavePod (buf); }
+  bool RestoreValues (const std::vector<char>& buf);
+#endif
+
   // Forwards to TTree with some extra
   virtual Int_t GetEntry (Long64_t index, Int_t getall=0);
   virtual Int_t Fill();
   Int_t Write (const char* name=0, Int_t option=0, Int_t bufsize=0) override;
+  Long64_t Checkpoint();   // flush (and autosave) now. Returns bytes written.
 
   // use a TChain
   Int_t Add (const char* name, Long64_t nentries=TTree::kMaxEntries);
 
+  // Add friend tree treename from file fname. Its branches are read as entry["alias.x"] (or "x" if no other tree has
+  // that branch). By default the friend's entries line up with ours. If major is given, the friend is indexed on
+  // (major,minor), and entries with no match in the friend read the default value. The friend's clusters are
+  // read by its own TTreeCache as we load each entry, so the two files are each read sequentially.
+  // Returns the friend TTree, or nullptr if it could not be opened.
+  TTree* AddFriend (const char* treename, const char* fname, const char* alias="", const char* major=nullptr, const char* minor="0");
+
   // Accessors
 
   // std::iterator interface
   Entry_iterator begin();
   Entry_iterator end();
   Fill_iterator FillEntries (Long64_t nfill=-1);
+  // Create all the schema's branches before filling. Branches already used must be the schema's first ones (in order),
+  // otherwise no entries are filled.
+  Fill_iterator FillEntries (Long64_t nfill, const Schema& schema);
+
+  // Call fn(const Entry&) for every entry, using nthreads threads (0 = one per core). The entries are split into tasks
+  // on cluster boundaries, and each thread reads them with its own TFile/TChain and TTreeIterator. Entries are not
+  // processed in order, so fn must be safe to call from several threads at once. Returns the number of entries.
+  template <typename Fn> Long64_t ParallelForEach (int nthreads, Fn&& fn);
+
+  // Parallel map-reduce: each cluster's entries are accumulated with map(acc, entry), starting from a copy of init,
+  // which should be the identity (eg. 0.0 for a sum). The cluster results are then combined with combine(result, acc)
+  // in entry order, so the result does not depend on the number of threads. eg.
+  //   double sum = iter.ParallelReduce (0, 0.0, [](double& s, const Entry& e) { s += e.Get<double>("x"); },
+  //                                             [](double& s, double t) { s += t; });
+  template <typename Acc, typename Map, typename Combine> Acc ParallelReduce (int nthreads, Acc init, Map&& map, Combine&& combine);
+
+  // Fill histograms in parallel: fill(entry, hists...) is called with each thread's own empty clones of the
+  // histograms, which are added into hists, in thread order, at the end. eg.
+  //   iter.ParallelFill (0, [](const Entry& e, TH2D& hxy, TH1D& hz) { hxy.Fill (e.Get<double>("vx"), e.Get<double>("vy")); }, hxy, hz);
+  template <typename FillFn, typename... Hists> Long64_t ParallelFill (int nthreads, FillFn&& fill, Hists&... hists);
+
+  // Fill nfill new entries using nthreads threads (0 = one per core), calling fn(Entry& entry, Long64_t ientry) for each,
+  // where ientry counts the new entries from 0. As in a FillEntries loop, fn sets the values and calls entry.Fill().
+  // Each thread fills a contiguous block of entries in its own TTreeIterator and temporary file, so there is no
+  // contention in TTree::Fill. The files' baskets are then appended to our tree in entry order, without being
+  // recompressed (TTree::CopyEntries "fast"). If our tree has no branches yet, it is replaced by an empty clone of the
+  // first thread's tree. Every thread must create the same branches in the same order - use a schema to ensure this -
+  // otherwise the call fails. The threads use our SetCheckpoint settings. Returns the number of entries added.
+  template <typename Fn> Long64_t ParallelFillEntries (int nthreads, Long64_t nfill, Fn&& fn);
+  template <typename Fn> Long64_t ParallelFillEntries (int nthreads, Long64_t nfill, const Schema& schema, Fn&& fn);
+
+  // Per-thread statistics from the last ParallelForEach, ParallelReduce, or ParallelFill.
+  struct WorkerStats {
+    Long64_t entries = 0;   // entries processed
+    size_t   tasks   = 0;   // clusters processed
+    size_t   stolen  = 0;   // clusters taken from another thread's queue
+    double   seconds = 0.0; // wall time processing clusters
+    double   openSeconds = 0.0; // wall time opening the thread's own file or chain (CloneForThread) beforehand
+  };
+  const std::vector<WorkerStats>& GetWorkerStats() const { return fWorkerStats; }
+
+  // Read statistics for one branch, or all branches together. The counts are kept unless compiled with NO_BranchValue_STATS.
+  struct BranchStats {
+    ULong64_t bytes   = 0;       // bytes read (uncompressed)
+    ULong64_t calls   = 0;       // TBranch::GetEntry calls
+    ULong64_t baskets = 0;       // calls that moved to another basket, which had to be read and decompressed
+    ULong64_t hits    = 0;       // cache lookups that found the branch at the next expected position
+    ULong64_t misses  = 0;       // cache lookups that had to search for it
+    double    seconds       = 0.0;   // time in TBranch::GetEntry (or TTree::GetEntry for the total), if SetStatsTiming
+    double    basketSeconds = 0.0;   // part of seconds spent in calls that moved to another basket
+    BranchStats& operator+= (const BranchStats& o) {
+      bytes += o.bytes; calls += o.calls; baskets += o.baskets; hits += o.hits; misses += o.misses;
+      seconds += o.seconds; basketSeconds += o.basketSeconds;
+      return *this;
+    }
+  };
+  struct Stats {
+    std::map<std::string,BranchStats> branches;   // by branch name
+    BranchStats total;
+    Long64_t  entries     = 0;     // entries loaded by Entry_iterator
+    ULong64_t fillBytes   = 0;     // bytes filled
+    ULong64_t writeBytes  = 0;     // bytes written when the tree was written at the end
+    double    loopSeconds = 0.0;   // time from loading each entry to loading the next, if SetStatsTiming
+    size_t    checkpoints = 0;     // SetCheckpoint flushes,
+    ULong64_t checkpointBytes = 0;         // the bytes they wrote,
+    double    checkpointSeconds = 0.0;     // their total latency,
+    double    maxCheckpointSeconds = 0.0;  // and the longest
+    double librarySeconds() const { return total.seconds; }
+    double userSeconds()    const { return loopSeconds > total.seconds ? loopSeconds - total.seconds : 0.0; }   // approximately
+    Stats& operator+= (const Stats& o) {
+      for (auto& b : o.branches) branches[b.first] += b.second;
+      total += o.total; entries += o.entries; fillBytes += o.fillBytes; writeBytes += o.writeBytes; loopSeconds += o.loopSeconds;
+      checkpoints += o.checkpoints; checkpointBytes += o.checkpointBytes; checkpointSeconds += o.checkpointSeconds;
+      if (o.maxCheckpointSeconds > maxCheckpointSeconds) maxCheckpointSeconds = o.maxCheckpointSeconds;
+      return *this;
+    }
+    void Reset() { *this = Stats(); }
+  };
+  // Snapshot of the statistics since the start, or the last ResetStats(), including those of the threads
+  // used by ParallelForEach etc.
+  Stats GetStats() const;
+  void  ResetStats();
+  // Time each branch read and entry loop (adds two clock reads per branch read)
+  TTreeIterator&  SetStatsTiming (bool timing)      { fStatsTiming = timing;      return *this; }
+  bool            GetStatsTiming()           const  { return       fStatsTiming;                }
+  // Write the statistics to fname when the TTreeIterator is deleted. If fname ends in ".json", a JSON object is appended
+  // as one line. Otherwise a CSV row with the timingTests.csv columns (testcase is the tree name, test is "*") is appended
+  // to fname, and the I/O counts for all branches and then for each (test is the branch name) to fname with "_io.csv"
+  // in place of ".csv". The label column is from the LABEL environment variable. A header is written to an empty file.
+  TTreeIterator&  SetStatsFile (const char* fname)  { fStatsFile = fname ? fname : ""; return *this; }
+  const char*     GetStatsFile()             const  { return       fStatsFile.c_str();          }
+  void            WriteStats (std::ostream& os, bool json=false, bool header=false) const;
+  void            WriteIOStats (std::ostream& os, bool header=false) const;
+  bool            WriteStats (const char* fname) const;
+#ifdef USE_TIMING_PROBES
+  // Print the histogram of times for each timing probe region (also done in ~TTreeIterator)
+  void            PrintProbes() const;
+#endif
+
+  // Like ParallelForEach, but using nprocs forked worker processes, for user code that is not thread-safe.
+  // Each worker starts with objs (eg. histograms, or an in-memory output TTree) Reset(), and calls fn(const Entry&)
+  // for a contiguous block of clusters. Its objs are then written to a temporary file and added into the parent's
+  // objs with their Merge(TCollection*) method, in entry order. An output TTree must be in memory (SetDirectory(nullptr)),
+  // because the workers share the parent's open files; its entries are copied into the parent's tree, which can then be
+  // written. Progress is shown every second if verbose >= 1. Returns the number of entries processed, or -1 if a worker
+  // could not be started or failed, in which case objs are not changed. Runs in this process on Windows.
+  template <typename Fn, typename... Objs> Long64_t ForkForEach (int nprocs, Fn&& fn, Objs&... objs);
+
+  // New TTreeIterator for reading the same tree or chain in another thread, with its own TFile/TChain handle.
+  // The branches already accessed here are set up in the same order, reusing what we found out about them
+  // (type, object or variable), without the per-type checks. Each clone has its own values, read state, and stats.
+  // Returns nullptr for an in-memory tree. Call ROOT::EnableThreadSafety() before using clones in several threads.
+  std::unique_ptr<TTreeIterator> CloneForThread() const;
+
+  // Index the entries on the values of integer key branches, eg. iter.BuildIndex({"run","event"}), for Find().
+  // The index is an open-addressing hash table of 12-byte slots, each holding the entry number, some bits of its
+  // key's hash, and a 31-bit fingerprint from a second hash, using about 16 bytes per entry (TTreeIndex uses 24).
+  // A lookup is confirmed from the slot alone, without any I/O, unless BuildIndex found a different key with the same
+  // hash bits and fingerprint, when the keys are read back from the tree - see test/indexBench.cxx.
+  // If fname is given, the index is loaded from that file, unless it is older than the tree's files or doesn't
+  // match, in which case it is built and saved there. Returns false on error.
+  bool BuildIndex (const std::vector<std::string>& keys, const char* fname=nullptr);
+  bool SaveIndex (const char* fname) const;
+  // Entry number with the given key values (in BuildIndex order), or -1 if there is none. If several entries
+  // have the same key, the first is returned.
+  Long64_t FindEntry (const std::vector<Long64_t>& keys) const;
+  // Entry with the given key values, ready to read, eg. double x = iter.Find(run,event)["x"];
+  // If not found, the Entry's index() is -1 and its values are the defaults.
+  template <typename... Keys> Entry Find (Keys... keys) {
+    Entry entry (*this, FindEntry (std::vector<Long64_t>{static_cast<Long64_t>(keys)...}));
+#ifdef USE_TTREE_GETENTRY
+    entry.GetEntry();
+#else
+    if (entry.index() >= 0) entry.LoadTree (entry.index());
+#endif
+    return entry;
+  }
 
 #ifdef USE_TTREE_GETENTRY
   // Set the status for a branch and all its sub-branches.
@@ -440,11 +926,15 @@ public:
   template <typename T> static T type_default() { return T(); }
   template <typename T> static const char* GetLeaflist()  { return GetLeaflistImpl<T>(0); }
 
-  template <typename T> static T& default_value() {
-    static T def = type_default<T>();   // static default value for each type to allow us to return by reference (NB. sticks around until program exit)
-    return def;
+  // Branch type for a Schema
+  template <typename T> static BranchType type (const char* leaflist=GetLeaflist<T>(), Int_t bufsize=-1, Int_t splitlevel=-1) {
+    return BranchType (type_code<T>(), &CreateSchemaBranch<T>, leaflist, bufsize, splitlevel);
   }
 
+  // Default value for each type, returned by reference when Get fails. Each TTreeIterator has its own, so a caller
+  // modifying it doesn't affect other iterators or threads.
+  template <typename T> T& default_value() const;
+
 private:
   template <typename T> static decltype(T::leaflist) GetLeaflistImpl(int)  { return T::leaflist; }
   template <typename T> static const char*           GetLeaflistImpl(long) { return nullptr;     }
@@ -454,8 +944,49 @@ protected:
   // remove_cvref_t (std::remove_cvref_t for C++11).
   template<typename T> using remove_cvref_t = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
 
+  // index_sequence and make_index_sequence (std::index_sequence for C++11).
+  template<std::size_t... I> struct index_sequence {};
+  template<std::size_t N, std::size_t... I> struct make_index_sequence : make_index_sequence<N-1, N-1, I...> {};
+  template<std::size_t... I> struct make_index_sequence<0, I...> : index_sequence<I...> {};
+
+  // Containers (eg. std::vector, std::string) that keep their allocated capacity when assigned to.
+  template<typename T, typename = void> struct reuses_capacity : std::false_type {};
+  template<typename T> struct reuses_capacity<T, decltype(void(std::declval<const T&>().capacity()))> : std::true_type {};
+
+#ifdef USE_TIMING_PROBES
+  // Timing probes: a histogram for each hot-path region of its durations, in power-of-2 bins of clock ticks
+  // (TSC cycles on x86, otherwise steady_clock ns). A ProbeScope times the rest of the block it is declared in.
+  enum ProbeRegion { kProbeLookup, kProbeRead, kProbeLoadTree, kProbeFill, kProbeWrite, kNprobes };
+  static ULong64_t ProbeTicks() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+  struct TimingProbe {
+    static constexpr int kBins = 40;
+    ULong64_t counts[kBins] = {};   // bin i has durations in [2^(i-1),2^i) ticks
+    ULong64_t ticks = 0, calls = 0;
+    void Add (ULong64_t dt) {
+      int bin = 0;
+      for (ULong64_t t = dt; t && bin < kBins-1; t >>= 1) bin++;
+      ++counts[bin];
+      ticks += dt;
+      ++calls;
+    }
+  };
+  struct ProbeScope {
+    TimingProbe& fProbe;
+    const ULong64_t fStart;
+    ProbeScope (TimingProbe& probe) : fProbe(probe), fStart(ProbeTicks()) {}
+    ~ProbeScope() { fProbe.Add (ProbeTicks() - fStart); }
+  };
+#endif
+
   // internal methods
   void Init (TDirectory* dir=nullptr, bool owned=true);
+  static double ClockSeconds() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
 #ifdef USE_TTREE_GETENTRY
   static void SetBranchStatus (TObjArray* list, bool status=true, bool include_children=true, int verbose=0, const std::string* pre=nullptr);
   static void SetBranchStatus (TBranch* branch, bool status=true, bool include_children=true, int verbose=0, const std::string* pre=nullptr);
@@ -476,29 +1007,117 @@ protected:
   template <typename T> BranchValue* NewBranch      (const char* name, Long64_t index, T&& val, const char* leaflist, Int_t bufsize, Int_t splitlevel);
   template <typename T> BranchValue* NewBranchValue (const char* name, T&& val) const;
   template <typename T> Int_t        FillBranch     (TBranch* branch, const char* name, Long64_t index);
+  template <typename T> static TBranch* CreateSchemaBranch (TTreeIterator& tree, const char* name, Long64_t index, const BranchType& type);
   void SetBranchAddressAll() const;
+  void TreeChanged() const;
+  void ReleaseAsyncOpen() const;
+  static const char* BranchTypeName (TBranch* branch);
+  Long64_t KnownEntries (Long64_t index) const;
+  Long64_t CachedEntries (const char* fname) const;
+  std::vector<std::pair<Long64_t,Long64_t>> ClusterRanges() const;
+  TTree* OpenTreeHandle (std::unique_ptr<TObject>& owner) const;
+  int ParallelThreads (int nthreads, size_t ntasks) const;
+  template <typename Task> Long64_t ParallelTasks (int nthreads, const std::vector<std::pair<Long64_t,Long64_t>>& ranges, Task&& task);
+  template <typename FillFn, std::size_t... I, typename... Hists> Long64_t ParallelFillImpl (int nthreads, FillFn&& fill, index_sequence<I...>, Hists&... hists);
+  template <typename H> static H* EmptyClone (const H& hist);
+  static std::string BranchLayoutDiff (TTree* a, TTree* b);
+  static std::vector<std::pair<size_t,size_t>> SplitRanges (const std::vector<std::pair<Long64_t,Long64_t>>& ranges, int nparts);
+  template <typename Fn, typename... Objs> int ForkWorker (const std::vector<std::pair<Long64_t,Long64_t>>& ranges, std::pair<size_t,size_t> block,
+                                                           const std::string& outname, std::atomic<Long64_t>& progress, Fn& fn, Objs&... objs);
+  template <typename Obj> static void MergeObject (Obj& obj, int index, const std::vector<std::unique_ptr<TFile>>& files);
+  template <typename T> static auto ResetObject (T& obj, int) -> decltype(obj.Reset(), void()) { obj.Reset(); }
+  template <typename T> static void ResetObject (T&,     long) {}
+  static ULong64_t KeyHash (const Long64_t* keys, size_t nkeys, ULong64_t seed=0x9E3779B97F4A7C15ULL);
+  static UInt_t    KeyFingerprint (const Long64_t* keys, size_t nkeys) { return UInt_t (KeyHash (keys, nkeys, 0xD1B54A32D192ED03ULL) >> 33); }
+  bool ReadKeys (Long64_t index, std::vector<TLeaf*>& leaves, Int_t& treenumber, Long64_t* vals) const;
+  bool LoadIndex (const char* fname);
+  void ForgetReads() const;
+#ifndef NO_BranchValue_STATS
+  BranchStats& StatsFor (const BranchValue* ibranch) const {
+    size_t i = ibranch - fBranches.data();
+    if (i >= fBranchStats.size()) fBranchStats.resize (fBranches.size());
+    return fBranchStats[i];
+  }
+#endif
 
   // Settings
   TTree* fTree       = nullptr;
   bool   fTreeOwned  = false;
   Int_t  fBufsize    = 32000;
   Int_t  fSplitlevel = 99;
+  Long64_t fAutoFlush       = 0;
+  Long64_t fOptimizeBaskets = 0;
   int    fVerbose    = 0;
+  bool   fBasketsOptimized = false;
 #ifndef OVERRIDE_BRANCH_ADDRESS  // only need flag if compiled in
   bool   fOverrideBranchAddress = false;
 #endif
+  std::vector<std::pair<std::string,int>> fCompression;   // (pattern, compression settings)
+  Long64_t fCheckpointEntries = 0;
+  Long64_t fCheckpointBytes   = 0;
+  double   fCheckpointSeconds = 0.0;
+  bool     fCheckpointAutoSave = true;
+  bool     fAsyncOpen = false;
+  bool     fLazy      = false;
+  std::string fEntriesCacheFile;
+  struct CachedCount { Long64_t size; Long_t mtime; Long64_t entries; };
+  mutable std::map<std::string,CachedCount> fEntriesCache;   // key is "tree<tab>file"
+  struct FriendSpec { std::string treename, fname, alias, major, minor; };
+  std::vector<FriendSpec> fFriends;   // AddFriend arguments, so CloneForThread can do the same
 
   // Stats
   ULong64_t fTotFill=0, fTotWrite=0;
+  ULong64_t fTotCheckpoint=0;                    // bytes written by checkpoints
+  size_t    fNcheckpoint=0;
+  double    fCheckpointTime=0.0, fMaxCheckpointTime=0.0;   // flush latency (seconds)
+  Long64_t  fLastCheckpointEntry=0;
+  ULong64_t fLastCheckpointFill=0;
+  double    fLastCheckpointClock=0.0;
+  std::vector<WorkerStats> fWorkerStats;
+  bool      fStatsTiming = false;
+  std::string fStatsFile;
+  double    fStatsStart = ClockSeconds();            // wall and CPU time at construction or ResetStats()
+  std::clock_t fStatsStartCpu = std::clock();
+  ULong64_t fFillBase=0, fWriteBase=0;           // fTotFill and fTotWrite at ResetStats()
+  Stats     fMergedStats;                        // from ParallelTasks' threads
 #ifndef NO_BranchValue_STATS
   mutable ULong64_t fTotRead=0;
   mutable size_t fNhits=0, fNmiss=0;
+  mutable Long64_t fNentries=0;
+  mutable double fLoopSeconds=0.0, fGetEntrySeconds=0.0;
+  mutable std::vector<BranchStats> fBranchStats; // same order as fBranches
+#endif
+#ifdef USE_TIMING_PROBES
+  mutable TimingProbe fProbes[kNprobes];
+  const ULong64_t fProbeTicks0 = ProbeTicks();   // to calibrate ticks against fProbeClock0
+  const double    fProbeClock0 = ClockSeconds();
 #endif
 
-  // BranchValue cache
+  // BranchValue cache. fValuePools and fValueArena must outlive the fBranches that point into them.
+#ifndef USE_VALUE_ARENA
+  mutable std::vector<std::pair<type_code_t,std::unique_ptr<ValuePoolBase>>> fValuePools;
+#else
+  mutable ValueArena fValueArena;
+#endif
   mutable std::vector<BranchValue>           fBranches;
+  mutable std::vector<std::pair<type_code_t,std::unique_ptr<ValuePoolBase>>> fDefaultValues;
   mutable std::vector<BranchValue>::iterator fLastBranch;
   mutable bool    fTryLast    = false;
+  mutable Int_t   fTreeNumber = -1;   // TChain file whose TBranch pointers are in fBranches
+  mutable Int_t   fAsyncNext  = -1;   // TChain file we have started opening
+  mutable std::string fAsyncFile;     // its name, until we have moved to another file
+  struct BindSlot { Int_t pos; std::string type; };
+  mutable std::vector<BindSlot> fBindPlan;   // for each fBranches entry: position in GetListOfBranches() (-1 if not top-level) and type in the last tree
+  mutable Int_t   fBindNbranches = -1;       // size of GetListOfBranches() when fBindPlan was made
+  std::unique_ptr<TObject> fOwnedHandle;   // TFile or TChain opened by CloneForThread
+
+  // Key index (see BuildIndex). Each slot is 0 if empty, or the key's hash with the low bits replaced by entry+1.
+  // fIndexCheck has the slot's fingerprint, with kIndexVerify set if that isn't enough to tell its key from another.
+  std::vector<std::string> fIndexKeys;
+  std::vector<ULong64_t>   fIndexTable;
+  std::vector<UInt_t>      fIndexCheck;
+  ULong64_t                fIndexEntryMask = 0;
+  static constexpr UInt_t  kIndexVerify = 0x80000000u;
 
 #ifndef NO_DICT
   ClassDefOverride(TTreeIterator,0);
@@ -514,5 +1133,8 @@ template<> inline long int      TTreeIterator::type_default() { return -1;  }
 template<> inline long long int TTreeIterator::type_default() { return -1;  }
 
 #include "TTreeIterator/detail/TTreeIterator_detail.h"
+#include "TTreeIterator/detail/TTreeIterator_parallel.h"
+#include "TTreeIterator/detail/TTreeIterator_fork.h"
+#include "TTreeIterator/detail/TTreeIterator_index.h"
 
 #endif /* ROOT_TTreeIterator */
@@ -18,6 +18,7 @@
 #include <utility>
 #include <type_traits>
 #include <cstdlib>
+#include <cstddef>
 
 // A type-safe container of any type.
 //
@@ -27,6 +28,9 @@
 // and de-STLified to make it easier to read (for me at least).
 //
 // A Cpp11::any object's state is either empty or it stores a contained object of CopyConstructible type.
+//
+// Cpp11::basic_any<Size> is the same, but objects up to Size bytes (rather than sizeof(void*)) are stored
+// inline, without a heap allocation. Cpp11::any is basic_any<sizeof(void*)>.
 
 #ifndef ANY_TEMPLATE_OPT
 # undef NO_ANY_ACCESS
@@ -63,8 +67,8 @@ namespace Cpp11
 #endif
   using any_type_code = const void*;
 
-  class any {
-  public:
+  // Helpers shared by all basic_any<Size>
+  struct any_base {
     // Some internal stuff from GCC's std namespace...
     // See specialisations of or_ and and_ at end of file
     template<typename...> struct or_;
@@ -93,6 +97,11 @@ namespace Cpp11
 #else
     [[noreturn]] static void throw_bad_any_cast() { std::abort();         }
 #endif
+  };
+
+  template <std::size_t Size>
+  class basic_any : public any_base {
+    static_assert(Size >= sizeof(void*), "basic_any buffer must be able to hold a pointer");
 
   private:
 
@@ -105,7 +114,7 @@ namespace Cpp11
       Storage& operator=(const Storage&) = delete;
 
       void* _ptr;
-      std::aligned_storage<sizeof(_ptr), alignof(void*)>::type _buffer;
+      typename std::aligned_storage<Size, (Size > sizeof(void*) ? alignof(std::max_align_t) : alignof(void*))>::type _buffer;
     };
 
     template<typename T,
@@ -121,7 +130,7 @@ namespace Cpp11
                                               Manager_external<T>>::type;
 
     template<typename T, typename V = typename std::decay<T>::type>
-    using Decay_if_not_any = typename std::enable_if<!std::is_same<V, any>::value, V>::type;
+    using Decay_if_not_any = typename std::enable_if<!std::is_same<V, basic_any>::value, V>::type;
 
     // Emplace with an object created from args as the contained object.
     template <typename T, typename... Args, typename Mgr = Manager<T>>
@@ -154,10 +163,10 @@ namespace Cpp11
     // construct/destruct
 
     // Default constructor, creates an empty object.
-    constexpr any() noexcept : _manager(nullptr) {}
+    constexpr basic_any() noexcept : _manager(nullptr) {}
 
     // Copy constructor, copies the state of other
-    any(const any& other) {
+    basic_any(const basic_any& other) {
       if (!other.has_value())
         _manager = nullptr;
       else {
@@ -168,7 +177,7 @@ namespace Cpp11
     }
 
     // Move constructor, transfer the state from other
-    any(any&& other) noexcept {
+    basic_any(basic_any&& other) noexcept {
       if (!other.has_value())
         _manager = nullptr;
       else {
@@ -182,35 +191,35 @@ namespace Cpp11
     template <typename T, typename V = Decay_if_not_any<T>,
               typename Mgr = Manager<V>,
               typename std::enable_if<std::is_copy_constructible<V>::value && !is_in_place_type<V>::value, bool>::type = true>
-    any(T&& value) : _manager(&Mgr::manage) {
+    basic_any(T&& value) : _manager(&Mgr::manage) {
       Mgr::create(_storage, std::forward<T>(value));
     }
 
     // Construct with an object created from args as the contained object.
     template <typename T, typename... Args, typename V = typename std::decay<T>::type, typename Mgr = Manager<V>, any_constructible_t<V, Args&&...> = false>
-    explicit any(in_place_type_t<T>, Args&&... args) : _manager(&Mgr::manage) {
+    explicit basic_any(in_place_type_t<T>, Args&&... args) : _manager(&Mgr::manage) {
       Mgr::create(_storage, std::forward<Args>(args)...);
     }
 
     // Construct with an object created from il and args as the contained object.
     template <typename T, typename Up, typename... Args, typename V = typename std::decay<T>::type, typename Mgr = Manager<V>, any_constructible_t<V, std::initializer_list<Up>, Args&&...> = false>
-    explicit any(in_place_type_t<T>, std::initializer_list<Up> il, Args&&... args) : _manager(&Mgr::manage) {
+    explicit basic_any(in_place_type_t<T>, std::initializer_list<Up> il, Args&&... args) : _manager(&Mgr::manage) {
       Mgr::create(_storage, il, std::forward<Args>(args)...);
     }
 
     // Destructor, calls reset()
-    ~any() { reset(); }
+    ~basic_any() { reset(); }
 
     // assignments
 
     // Copy the state of another object.
-    any& operator=(const any& rhs) {
-      *this = any(rhs);
+    basic_any& operator=(const basic_any& rhs) {
+      *this = basic_any(rhs);
       return *this;
     }
 
     // Move assignment operator
-    any& operator=(any&& rhs) noexcept {
+    basic_any& operator=(basic_any&& rhs) noexcept {
       if (!rhs.has_value())
         reset();
       else if (this != &rhs) {
@@ -224,17 +233,17 @@ namespace Cpp11
 
     // Store a copy of rhs as the contained object.
     template<typename T>
-    typename std::enable_if<std::is_copy_constructible<Decay_if_not_any<T>>::value, any&>::type
+    typename std::enable_if<std::is_copy_constructible<Decay_if_not_any<T>>::value, basic_any&>::type
     operator=(T&& rhs) {
 #ifdef ANY_SAME_TYPE
       using V = typename std::decay<T>::type;
-      if (_manager == &any::Manager<V>::manage) {
+      if (_manager == &Manager<V>::manage) {
         V* ptr = unchecked_any_caster<V>();
         ptr->~V();
         ::new(ptr) V(std::forward<T>(rhs));
       } else
 #endif
-        *this = any(std::forward<T>(rhs));
+        *this = basic_any(std::forward<T>(rhs));
       return *this;
     }
 
@@ -243,7 +252,7 @@ namespace Cpp11
     emplace_t<typename std::decay<T>::type, Args...> emplace(Args&&... args) {
       using V = typename std::decay<T>::type;
 #ifdef ANY_SAME_TYPE
-      if (_manager == &any::Manager<V>::manage) {
+      if (_manager == &Manager<V>::manage) {
         V* ptr = unchecked_any_caster<V>();
         ptr->~V();
         ::new(ptr) V(std::forward<Args>(args)...);
@@ -259,7 +268,7 @@ namespace Cpp11
     emplace_t<typename std::decay<T>::type, std::initializer_list<Up>, Args&&...> emplace(std::initializer_list<Up> il, Args&&... args) {
       using V = typename std::decay<T>::type;
 #ifdef ANY_SAME_TYPE
-      if (_manager == &any::Manager<V>::manage) {
+      if (_manager == &Manager<V>::manage) {
         V* ptr = unchecked_any_caster<V>();
         ptr->~V();
         ::new(ptr) V(il, std::forward<Args>(args)...);
@@ -281,11 +290,11 @@ namespace Cpp11
     }
 
     // Exchange state with another object.
-    void swap(any& rhs) noexcept {
+    void swap(basic_any& rhs) noexcept {
       if (!has_value() && !rhs.has_value()) return;
       if (has_value() && rhs.has_value()) {
         if (this == &rhs) return;
-        any tmp;
+        basic_any tmp;
         Arg arg;
         arg._any = &tmp;
         rhs._manager(Op_xfer, &rhs, &arg);
@@ -294,8 +303,8 @@ namespace Cpp11
         arg._any = this;
         tmp._manager(Op_xfer, &tmp, &arg);
       } else {
-        any* empty = !has_value() ? this : &rhs;
-        any* full = !has_value() ? &rhs : this;
+        basic_any* empty = !has_value() ? this : &rhs;
+        basic_any* full = !has_value() ? &rhs : this;
         Arg arg;
         arg._any = empty;
         full->_manager(Op_xfer, full, &arg);
@@ -323,9 +332,12 @@ namespace Cpp11
 
     template<typename T> static constexpr any_type_code type_code() {
       using Up = remove_cvref_t<T>;
-      return reinterpret_cast<any_type_code>(&any::Manager<Up>::manage);
+      return reinterpret_cast<any_type_code>(&Manager<Up>::manage);
     }
 
+    // Whether T is stored inline (true) or on the heap (false)
+    template<typename T> static constexpr bool is_inline() { return Internal<remove_cvref_t<T>>::value; }
+
     template<typename T> static constexpr bool is_valid_cast() { return or_<std::is_reference<T>, std::is_copy_constructible<T>>::value; }
 
   private:
@@ -344,16 +356,16 @@ namespace Cpp11
     union Arg {
       void* _obj;
       const std::type_info* _typeinfo;
-      any* _any;
+      basic_any* _any;
     };
 
-    void (*_manager)(Op, const any*, Arg*);
+    void (*_manager)(Op, const basic_any*, Arg*);
     Storage _storage;
 
     // Manage in-place contained object.
     template<typename T>
     struct Manager_internal {
-      static void manage(Op which, const any* anyp, Arg* arg);
+      static void manage(Op which, const basic_any* anyp, Arg* arg);
 
       template<typename Up>
       static void create(Storage& storage, Up&& value) {
@@ -378,7 +390,7 @@ namespace Cpp11
     // Manage external contained object.
     template<typename T>
     struct Manager_external {
-      static void manage(Op which, const any* anyp, Arg* arg);
+      static void manage(Op which, const basic_any* anyp, Arg* arg);
 
       template<typename Up>
       static void create(Storage& storage, Up&& value) {
@@ -401,11 +413,11 @@ namespace Cpp11
     template<typename T>
     T* unchecked_any_caster() const {
 #ifndef ANY_TEMPLATE_OPT
-      any::Arg arg;
-      _manager(any::Op_access, this, &arg);
+      Arg arg;
+      _manager(Op_access, this, &arg);
       return static_cast<T*>(arg._obj);
 #else
-      return any::Manager<T>::access(_storage);
+      return Manager<T>::access(_storage);
 #endif
     }
 
@@ -423,7 +435,7 @@ namespace Cpp11
       else
 #endif
 #ifndef UNCHECKED_ANY
-        if (_manager == &any::Manager<Up>::manage
+        if (_manager == &Manager<Up>::manage
 #if !defined(NO_ANY_RTTI) && !defined(NO_ANY_RTTI_CHECK)
             // see https://gcc.gnu.org/git/?p=gcc.git;a=commit;h=aa573a6a3e165632103f2f8defb9768106db6a61
             // for why this is needed. Fortunately it is rarely used, so doesn't usually slow us down
@@ -439,6 +451,8 @@ namespace Cpp11
 
   };
 
+  using any = basic_any<sizeof(void*)>;
+
 #ifdef Cpp11_std_any
   using Cpp11_any = std::any;
 #else
@@ -446,56 +460,57 @@ namespace Cpp11
 #endif
 
   // Exchange the states of two any objects.
-  inline void swap(any& x, any& y) noexcept { x.swap(y); }
+  template<std::size_t Size>
+  inline void swap(basic_any<Size>& x, basic_any<Size>& y) noexcept { x.swap(y); }
 
   // Create an any holding a T constructed from args.
   template <typename T, typename... Args>
   inline any make_any(Args&&... args) {
-    return any(Cpp11_any::Cpp11_in_place_type(T), std::forward<Args>(args)...);
+    return any(any_base::Cpp11_in_place_type(T), std::forward<Args>(args)...);
   }
 
   // Create an any holding a T constructed from il and args.
   template <typename T, typename Up, typename... Args>
   inline any make_any(std::initializer_list<Up> il, Args&&... args) {
-    return any(Cpp11_any::Cpp11_in_place_type(T), il, std::forward<Args>(args)...);
+    return any(any_base::Cpp11_in_place_type(T), il, std::forward<Args>(args)...);
   }
 
   // Access the contained object.
   //   ValueType  A const-reference or CopyConstructible type.
   //   any_       The object to access.
   //   returns    The contained object.
-  template<typename ValueType>
-  inline ValueType any_cast(const any& any_) {
-    using Up = Cpp11_any::remove_cvref_t<ValueType>;
-    static_assert(any::is_valid_cast<ValueType>(),                    "Template argument must be a reference or CopyConstructible type");
+  template<typename ValueType, std::size_t Size>
+  inline ValueType any_cast(const basic_any<Size>& any_) {
+    using Up = any_base::remove_cvref_t<ValueType>;
+    static_assert(basic_any<Size>::template is_valid_cast<ValueType>(), "Template argument must be a reference or CopyConstructible type");
     static_assert(std::is_constructible<ValueType, const Up&>::value, "Template argument must be constructible from a const value.");
-    auto p = any_.any_caster<Up>();
+    auto p = any_.template any_caster<Up>();
     if (p) return static_cast<ValueType>(*p);
-    Cpp11_any::throw_bad_any_cast();
+    any_base::throw_bad_any_cast();
   }
 
   // Access the contained object.
   //   ValueType  A reference or CopyConstructible type.
   //   any_       The object to access.
   //   returns    The contained object.
-  template<typename ValueType>
-  inline ValueType any_cast(any& any_) {
-    using Up = Cpp11_any::remove_cvref_t<ValueType>;
-    static_assert(any::is_valid_cast<ValueType>(),              "Template argument must be a reference or CopyConstructible type");
+  template<typename ValueType, std::size_t Size>
+  inline ValueType any_cast(basic_any<Size>& any_) {
+    using Up = any_base::remove_cvref_t<ValueType>;
+    static_assert(basic_any<Size>::template is_valid_cast<ValueType>(), "Template argument must be a reference or CopyConstructible type");
     static_assert(std::is_constructible<ValueType, Up&>::value, "Template argument must be constructible from an lvalue.");
-    auto p = any_.any_caster<Up>();
+    auto p = any_.template any_caster<Up>();
     if (p) return static_cast<ValueType>(*p);
-    Cpp11_any::throw_bad_any_cast();
+    any_base::throw_bad_any_cast();
   }
 
-  template<typename ValueType>
-  inline ValueType any_cast(any&& any_) {
-    using Up = Cpp11_any::remove_cvref_t<ValueType>;
-    static_assert(any::is_valid_cast<ValueType>(),             "Template argument must be a reference or CopyConstructible type");
+  template<typename ValueType, std::size_t Size>
+  inline ValueType any_cast(basic_any<Size>&& any_) {
+    using Up = any_base::remove_cvref_t<ValueType>;
+    static_assert(basic_any<Size>::template is_valid_cast<ValueType>(), "Template argument must be a reference or CopyConstructible type");
     static_assert(std::is_constructible<ValueType, Up>::value, "Template argument must be constructible from an rvalue.");
-    auto p = any_.any_caster<Up>();
+    auto p = any_.template any_caster<Up>();
     if (p) return static_cast<ValueType>(std::move(*p));
-    Cpp11_any::throw_bad_any_cast();
+    any_base::throw_bad_any_cast();
   }
 
   // Access the contained object.
@@ -504,25 +519,25 @@ namespace Cpp11
   //   returns    The address of the contained object if
   //                any_ != nullptr && any_.type() == typeid(ValueType)
   //              otherwise a null pointer.
-  template<typename ValueType>
-  inline const ValueType* any_cast(const any* any_) noexcept {
+  template<typename ValueType, std::size_t Size>
+  inline const ValueType* any_cast(const basic_any<Size>* any_) noexcept {
     if (!any_) return nullptr;
-    return any_->any_caster<ValueType>();
+    return any_->template any_caster<ValueType>();
   }
 
-  template<typename ValueType>
-  inline ValueType* any_cast(any* any_) noexcept {
+  template<typename ValueType, std::size_t Size>
+  inline ValueType* any_cast(basic_any<Size>* any_) noexcept {
     if (!any_) return nullptr;
-    return any_->any_caster<ValueType>();
+    return any_->template any_caster<ValueType>();
   }
 
-  template<typename ValueType>
+  template<typename ValueType, std::size_t Size=sizeof(void*)>
   inline constexpr any_type_code type_code() {
-    return any::type_code<ValueType>();
+    return basic_any<Size>::template type_code<ValueType>();
   }
 
-  template<typename T>
-  void any::Manager_internal<T>::manage(Op which, const any* any_, Arg* arg) {
+  template<std::size_t Size> template<typename T>
+  void basic_any<Size>::Manager_internal<T>::manage(Op which, const basic_any* any_, Arg* arg) {
     // The contained object is in _storage._buffer
     auto ptr = reinterpret_cast<const T*>(&any_->_storage._buffer);
     switch (which) {
@@ -547,13 +562,13 @@ namespace Cpp11
       ::new(&arg->_any->_storage._buffer) T(std::move(*const_cast<T*>(ptr)));
       ptr->~T();
       arg->_any->_manager = any_->_manager;
-      const_cast<any*>(any_)->_manager = nullptr;
+      const_cast<basic_any*>(any_)->_manager = nullptr;
       break;
     }
   }
 
-  template<typename T>
-  void any::Manager_external<T>::manage(Op which, const any* any_, Arg* arg) {
+  template<std::size_t Size> template<typename T>
+  void basic_any<Size>::Manager_external<T>::manage(Op which, const basic_any* any_, Arg* arg) {
     // The contained object is *_storage._ptr
     auto ptr = static_cast<const T*>(any_->_storage._ptr);
     switch (which) {
@@ -577,14 +592,14 @@ namespace Cpp11
     case Op_xfer:
       arg->_any->_storage._ptr = any_->_storage._ptr;
       arg->_any->_manager = any_->_manager;
-      const_cast<any*>(any_)->_manager = nullptr;
+      const_cast<basic_any*>(any_)->_manager = nullptr;
       break;
     }
   }
 
   // specialisations of or_ and and_ from top of any
-  template<> struct any::or_<>  : public std::false_type {};
-  template<> struct any::and_<> : public std::true_type  {};
+  template<> struct any_base::or_<>  : public std::false_type {};
+  template<> struct any_base::and_<> : public std::true_type  {};
 }
 
 #endif /* HEADER_Cpp11_any */
@@ -5,9 +5,17 @@
 #define ROOT_TTreeIterator_detail
 
 #include <limits>
+#include <fstream>
+#include <cmath>
+#include <sstream>
 #include "TError.h"
 #include "TFile.h"
 #include "TChain.h"
+#include "TLeaf.h"
+#include "TRegexp.h"
+#include "TSystem.h"
+#include "TChainElement.h"
+#include "TFriendElement.h"
 
 // TTreeIterator ===============================================================
 
@@ -44,6 +52,7 @@ inline TTree* TTreeIterator::SetTree (TTree* tree) {
 // use a TChain
 inline Int_t TTreeIterator::Add (const char* name, Long64_t nentries/*=TTree::kMaxEntries*/) {
   auto chain = dynamic_cast<TChain*>(fTree);
+  if (nentries == TTree::kMaxEntries && !fEntriesCacheFile.empty()) nentries = CachedEntries (name);
   if (!chain) {
     chain = new TChain (GetName(), GetTitle());
     if (fTree && fTree->GetEntriesFast()) {
@@ -64,7 +73,103 @@ inline Int_t TTreeIterator::Add (const char* name, Long64_t nentries/*=TTree::kM
 }
 
 
+inline TTree* TTreeIterator::AddFriend (const char* treename, const char* fname, const char* alias/*=""*/, const char* major/*=nullptr*/, const char* minor/*="0"*/) {
+  if (!fTree) {
+    if (verbose() >= 0) Error ("AddFriend", "no tree available");
+    return nullptr;
+  }
+  if (!alias) alias = "";
+  std::string fullname = *alias ? std::string(alias) + "=" + treename : std::string(treename);   // TTree::AddFriend's "alias=treename"
+  TFriendElement* fe = fTree->AddFriend (fullname.c_str(), fname);
+  TTree* ft = fe ? fe->GetTree() : nullptr;
+  if (!ft) {
+    if (verbose() >= 0) Error ("AddFriend", "could not open friend tree '%s' in file %s", treename, fname);
+    return nullptr;
+  }
+  if (major && *major && !ft->GetTreeIndex() && ft->BuildIndex (major, minor) <= 0) {
+    if (verbose() >= 0) Error ("AddFriend", "could not build index (%s,%s) for friend tree '%s'", major, minor, treename);
+    return nullptr;
+  }
+  if (Long64_t cachesize = fTree->GetCacheSize()) ft->SetCacheSize (cachesize);
+#ifdef USE_TTREE_GETENTRY
+  SetBranchStatus (ft->GetListOfBranches(), false, true, verbose());   // as for our own branches in Init()
+#endif
+  fFriends.push_back (FriendSpec{treename, fname, alias, (major ? major : ""), (minor ? minor : "0")});
+  if (verbose() >= 1) Info ("AddFriend", "added %s friend tree '%s' from %s%s%s", (major && *major ? "indexed" : "aligned"), treename, fname,
+                            (*alias ? " as " : ""), alias);
+  return ft;
+}
+
+
+inline bool TTreeIterator::SetEntriesCache (const char* fname) {
+  fEntriesCacheFile = fname ? fname : "";
+  fEntriesCache.clear();
+  if (fEntriesCacheFile.empty()) return true;
+  std::ifstream in (fEntriesCacheFile);
+  if (!in) return gSystem->AccessPathName (fEntriesCacheFile.c_str());   // OK if it doesn't exist yet
+  std::string line;
+  while (std::getline (in, line)) {
+    std::istringstream ls (line);
+    std::string tname, file;
+    CachedCount c;
+    if (std::getline (ls, tname, '\t') && std::getline (ls, file, '\t') && (ls >> c.size >> c.mtime >> c.entries))
+      fEntriesCache[tname + '\t' + file] = c;
+  }
+  if (verbose() >= 1) Info ("SetEntriesCache", "read %zu entry counts from %s", fEntriesCache.size(), fEntriesCacheFile.c_str());
+  return true;
+}
+
+
+// Entry count for file from the cache, or TTree::kMaxEntries if unknown or the file has changed
+inline Long64_t TTreeIterator::CachedEntries (const char* fname) const {
+  if (std::strpbrk (fname, "*?[")) return TTree::kMaxEntries;   // wildcards are expanded by TChain::Add
+  auto it = fEntriesCache.find (std::string(GetName()) + '\t' + fname);
+  if (it == fEntriesCache.end()) return TTree::kMaxEntries;
+  FileStat_t st;
+  if (gSystem->GetPathInfo (fname, st) != 0 || st.fSize != it->second.size || st.fMtime != it->second.mtime) {
+    if (verbose() >= 1) Info ("Add", "file %s has changed since its entry count was cached", fname);
+    return TTree::kMaxEntries;
+  }
+  return it->second.entries;
+}
+
+
+inline bool TTreeIterator::SaveEntriesCache() const {
+  if (fEntriesCacheFile.empty()) return false;
+  auto chain = dynamic_cast<TChain*>(GetTree());
+  if (!chain) return true;
+  bool changed = false;
+  TObjArray* files = chain->GetListOfFiles();
+  for (Int_t i = 0, n = files->GetEntriesFast(); i < n; i++) {
+    auto element = static_cast<TChainElement*>(files->UncheckedAt(i));
+    Long64_t nentries = element->GetEntries();   // set by TChain when it opens the file
+    FileStat_t st;
+    if (nentries < 0 || nentries >= TTree::kMaxEntries || gSystem->GetPathInfo (element->GetTitle(), st) != 0) continue;
+    CachedCount& c = fEntriesCache[std::string(GetName()) + '\t' + element->GetTitle()];
+    if (c.size == st.fSize && c.mtime == st.fMtime && c.entries == nentries) continue;
+    c = CachedCount {st.fSize, st.fMtime, nentries};
+    changed = true;
+  }
+  if (!changed) return true;
+  std::ofstream out (fEntriesCacheFile);
+  for (auto& e : fEntriesCache)
+    out << e.first << '\t' << e.second.size << ' ' << e.second.mtime << ' ' << e.second.entries << '\n';
+  if (!out) {
+    if (verbose() >= 0) Error ("SaveEntriesCache", "could not write %s", fEntriesCacheFile.c_str());
+    return false;
+  }
+  if (verbose() >= 1) Info ("SaveEntriesCache", "wrote %zu entry counts to %s", fEntriesCache.size(), fEntriesCacheFile.c_str());
+  return true;
+}
+
+
 inline TTreeIterator::~TTreeIterator() /*override*/ {
+  if (!fEntriesCacheFile.empty()) SaveEntriesCache();
+  if (!fStatsFile.empty()) WriteStats (fStatsFile.c_str());
+  ReleaseAsyncOpen();
+#ifdef USE_TIMING_PROBES
+  PrintProbes();
+#endif
   if (verbose() >= 1 && fBranches.size() > 0)
     Info ("~TTreeIterator", "ResetAddress for %zu branches", fBranches.size());
   for (auto ibranch = fBranches.rbegin(), end = fBranches.rend(); ibranch != end; ++ibranch) {
@@ -82,6 +187,12 @@ inline TTreeIterator::~TTreeIterator() /*override*/ {
 #endif
     if (fTotFill>0 || fTotWrite>0)
       Info ("TTreeIterator", "filled %lld bytes total; wrote %lld bytes at end", fTotFill, fTotWrite);
+#ifdef USE_VALUE_ARENA
+    if (fValueArena.size()>0)
+      Info ("TTreeIterator", "value arena holds %zu bytes, %zu trivially copyable", fValueArena.size(), fValueArena.PodSize());
+#endif
+    if (fNcheckpoint>0)
+      Info ("TTreeIterator", "%zu checkpoints wrote %lld bytes, taking %.3f s total, %.3f s max", fNcheckpoint, fTotCheckpoint, fCheckpointTime, fMaxCheckpointTime);
 #ifndef NO_BranchValue_STATS
     if (fTotRead>0)
       Info ("TTreeIterator", "read %lld bytes total", fTotRead);
@@ -90,8 +201,205 @@ inline TTreeIterator::~TTreeIterator() /*override*/ {
 }
 
 
+inline TTreeIterator::Stats TTreeIterator::GetStats() const {
+  Stats stats = fMergedStats;
+  Stats own;
+  own.fillBytes  = fTotFill  - fFillBase;
+  own.writeBytes = fTotWrite - fWriteBase;
+  own.checkpoints          = fNcheckpoint;
+  own.checkpointBytes      = fTotCheckpoint;
+  own.checkpointSeconds    = fCheckpointTime;
+  own.maxCheckpointSeconds = fMaxCheckpointTime;
+#ifndef NO_BranchValue_STATS
+  for (size_t i = 0; i < fBranchStats.size() && i < fBranches.size(); i++) {
+    own.branches[fBranches[i].GetName()] += fBranchStats[i];   // a branch read as different types is counted once
+    own.total += fBranchStats[i];
+  }
+  own.total.bytes   = fTotRead;   // also includes TTree::GetEntry reads
+  own.total.hits    = fNhits;
+  own.total.misses  = fNmiss;
+  own.total.seconds += fGetEntrySeconds;
+  own.entries     = fNentries;
+  own.loopSeconds = fLoopSeconds;
+#endif
+  stats += own;
+  return stats;
+}
+
+
+inline void TTreeIterator::ResetStats() {
+  fFillBase  = fTotFill;
+  fWriteBase = fTotWrite;
+  fTotCheckpoint = 0;
+  fNcheckpoint = 0;
+  fCheckpointTime = fMaxCheckpointTime = 0.0;
+  fMergedStats.Reset();
+  fStatsStart    = ClockSeconds();
+  fStatsStartCpu = std::clock();
+#ifndef NO_BranchValue_STATS
+  fTotRead = 0;
+  fNhits = fNmiss = 0;
+  fNentries = 0;
+  fLoopSeconds = fGetEntrySeconds = 0.0;
+  fBranchStats.clear();
+#endif
+}
+
+
+inline void TTreeIterator::WriteStats (std::ostream& os, bool json/*=false*/, bool header/*=false*/) const {
+  const Stats stats = GetStats();
+  auto now = std::time(0);
+  char stamp[22];
+  std::strftime (stamp, sizeof(stamp), "%Y-%m-%d-%H:%M:%S", std::localtime(&now));
+  const char* host  = gSystem->HostName();
+  const char* label = gSystem->Getenv("LABEL");
+  if (!label) label = "";
+  const long long ms  = std::llround ((ClockSeconds() - fStatsStart) * 1000.0);
+  const long long cpu = std::llround (double(std::clock() - fStatsStartCpu) * 1000.0 / CLOCKS_PER_SEC);   // whole process
+  const bool fill = stats.fillBytes > 0;
+
+  if (json) {
+    auto quote = [](const std::string& str) {
+      std::string q = "\"";
+      for (char c : str) {
+        if (c == '"' || c == '\\') q += '\\';
+        q += c;
+      }
+      return q + '"';
+    };
+    auto counts = [&](const BranchStats& b) {
+      os << "{\"bytes\":" << b.bytes << ",\"calls\":" << b.calls << ",\"baskets\":" << b.baskets
+         << ",\"hits\":" << b.hits << ",\"misses\":" << b.misses
+         << ",\"read_ms\":" << b.seconds*1000.0 << ",\"basket_ms\":" << b.basketSeconds*1000.0 << "}";
+    };
+    os << "{\"time\":" << quote(stamp) << ",\"host\":" << quote(host) << ",\"label\":" << quote(label)
+       << ",\"tree\":" << quote(GetName()) << ",\"fill\":" << (fill ? "true" : "false")
+       << ",\"entries\":" << stats.entries << ",\"branches\":" << stats.branches.size()
+       << ",\"ms\":" << ms << ",\"cpu\":" << cpu
+       << ",\"fill_bytes\":" << stats.fillBytes << ",\"write_bytes\":" << stats.writeBytes
+       << ",\"loop_ms\":" << stats.loopSeconds*1000.0 << ",\"user_ms\":" << stats.userSeconds()*1000.0
+       << ",\"checkpoints\":" << stats.checkpoints << ",\"checkpoint_bytes\":" << stats.checkpointBytes
+       << ",\"checkpoint_ms\":" << stats.checkpointSeconds*1000.0 << ",\"checkpoint_max_ms\":" << stats.maxCheckpointSeconds*1000.0
+       << ",\"total\":";
+    counts (stats.total);
+    os << ",\"branch\":{";
+    const char* sep = "";
+    for (auto& b : stats.branches) {
+      os << sep << quote(b.first) << ':';
+      counts (b.second);
+      sep = ",";
+    }
+    os << "}}\n";
+    return;
+  }
+
+  // Timing columns as in timingTests.csv. Only the total row is written: the element count per branch is not known
+  // here, so it is 0. Per-branch times are in WriteIOStats's read_ms column.
+  auto csv = [](const char* str) {
+    std::string q = "\"";
+    for (const char* c = str; *c; c++) {
+      if (*c == '"') q += '"';
+      q += *c;
+    }
+    return q + '"';
+  };
+  if (header)
+    os << "time/C,host/C,label/C,testcase/C,test/C,fill/B,entries/L,branches/I,elements/l,ms/D,cpu/D\n";
+  os << stamp << ',' << csv(host) << ',' << csv(label) << ',' << csv(GetName()) << ",\"*\"," << fill
+     << ',' << stats.entries << ',' << stats.branches.size() << ",0," << ms << ',' << cpu << '\n';
+}
+
+
+inline void TTreeIterator::WriteIOStats (std::ostream& os, bool header/*=false*/) const {
+  const Stats stats = GetStats();
+  auto now = std::time(0);
+  char stamp[22];
+  std::strftime (stamp, sizeof(stamp), "%Y-%m-%d-%H:%M:%S", std::localtime(&now));
+  const char* host  = gSystem->HostName();
+  const char* label = gSystem->Getenv("LABEL");
+  if (!label) label = "";
+  auto csv = [](const char* str) {
+    std::string q = "\"";
+    for (const char* c = str; *c; c++) {
+      if (*c == '"') q += '"';
+      q += *c;
+    }
+    return q + '"';
+  };
+  if (header)
+    os << "time/C,host/C,label/C,testcase/C,test/C,bytes/l,calls/l,baskets/l,hits/l,misses/l,read_ms/D,basket_ms/D,"
+          "user_ms/D,checkpoints/l,checkpoint_bytes/l,checkpoint_ms/D,checkpoint_max_ms/D\n";
+  auto row = [&](const char* test, const BranchStats& b, bool all) {
+    os << stamp << ',' << csv(host) << ',' << csv(label) << ',' << csv(GetName()) << ',' << csv(test)
+       << ',' << b.bytes << ',' << b.calls << ',' << b.baskets << ',' << b.hits << ',' << b.misses
+       << ',' << b.seconds*1000.0 << ',' << b.basketSeconds*1000.0;
+    if (all)   // user time and checkpoints are for the whole tree
+      os << ',' << stats.userSeconds()*1000.0 << ',' << stats.checkpoints << ',' << stats.checkpointBytes
+         << ',' << stats.checkpointSeconds*1000.0 << ',' << stats.maxCheckpointSeconds*1000.0 << '\n';
+    else
+      os << ",0,0,0,0,0\n";
+  };
+  row ("*", stats.total, true);
+  for (auto& b : stats.branches)
+    row (b.first.c_str(), b.second, false);
+}
+
+
+inline bool TTreeIterator::WriteStats (const char* fname) const {
+  std::string name = fname;
+  const bool json = (name.size() >= 5 && name.compare (name.size()-5, 5, ".json") == 0);
+  // Only write a header to a new or empty file (tellp() is 0 in append mode even for an existing file)
+  auto empty = [](const std::string& f) { FileStat_t st; return gSystem->GetPathInfo (f.c_str(), st) != 0 || st.fSize == 0; };
+  bool ok;
+  {
+    const bool header = empty (name);
+    std::ofstream os (fname, std::ios::app);
+    WriteStats (os, json, header);
+    ok = bool(os);
+  }
+  if (ok && !json) {
+    std::string ioname = name;
+    if (ioname.size() >= 4 && ioname.compare (ioname.size()-4, 4, ".csv") == 0) ioname.resize (ioname.size()-4);
+    ioname += "_io.csv";
+    const bool header = empty (ioname);
+    std::ofstream io (ioname, std::ios::app);
+    WriteIOStats (io, header);
+    ok = bool(io);
+    if (!ok) name = ioname;
+  }
+  if (!ok) {
+    if (verbose() >= 0) Error ("WriteStats", "could not write stats to %s", name.c_str());
+    return false;
+  }
+  if (verbose() >= 1) Info ("WriteStats", "wrote stats to %s", fname);
+  return true;
+}
+
+
+#ifdef USE_TIMING_PROBES
+inline void TTreeIterator::PrintProbes() const {
+  static const char* const names[kNprobes] = {"GetBranchValue", "GetBranch (I/O)", "LoadTree", "Fill", "Write"};
+  const double elapsed = ClockSeconds() - fProbeClock0;
+  const double nsPerTick = elapsed > 0.0 ? 1e9 * elapsed / double(ProbeTicks() - fProbeTicks0) : 1.0;
+  for (int i = 0; i < kNprobes; i++) {
+    const TimingProbe& p = fProbes[i];
+    if (!p.calls) continue;
+    Info ("TimingProbe", "%-15s %10llu calls, %10.3f ms total, %8.1f ns mean", names[i],
+          p.calls, 1e-6 * nsPerTick * p.ticks, nsPerTick * p.ticks / p.calls);
+    for (int bin = 0; bin < TimingProbe::kBins; bin++) {
+      if (!p.counts[bin]) continue;
+      const double lo = bin ? nsPerTick * double(ULong64_t(1) << (bin-1)) : 0.0;
+      Info ("TimingProbe", "%-15s %10.0f - %10.0f ns: %10llu %5.1f%%", "", lo, nsPerTick * double(ULong64_t(1) << bin),
+            p.counts[bin], 100.0 * p.counts[bin] / p.calls);
+    }
+  }
+}
+#endif
+
+
 // std::iterator interface
 inline TTreeIterator::Entry_iterator TTreeIterator::begin() {
+  if (fLazy && dynamic_cast<TChain*>(GetTree())) return Entry_iterator (*this, 0, Entry_iterator::kLazyEnd);
   Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
   if (verbose() >= 1 && last>0 && GetTree()->GetDirectory())
     Info ("TTreeIterator", "get %lld entries from tree '%s' in file %s", last, GetTree()->GetName(), GetTree()->GetDirectory()->GetName());
@@ -100,6 +408,7 @@ inline TTreeIterator::Entry_iterator TTreeIterator::begin() {
 
 
 inline TTreeIterator::Entry_iterator TTreeIterator::end()   {
+  if (fLazy && dynamic_cast<TChain*>(GetTree())) return Entry_iterator (*this, Entry_iterator::kLazyEnd, Entry_iterator::kLazyEnd);
   Long64_t last = GetTree() ? GetTree()->GetEntries() : 0;
   return Entry_iterator (*this, last, last);
 }
@@ -113,7 +422,17 @@ inline /*virtual*/ Int_t TTreeIterator::GetEntry (Long64_t index, Int_t getall/*
     return -1;
   }
 
+#ifdef USE_TIMING_PROBES
+  ProbeScope probe (fProbes[kProbeRead]);   // all branches' I/O, with USE_TTREE_GETENTRY
+#endif
+#ifndef NO_BranchValue_STATS
+  const double t0 = fStatsTiming ? ClockSeconds() : 0.0;
+#endif
   Int_t nbytes = fTree->GetEntry (index, getall);
+#ifndef NO_BranchValue_STATS
+  if (fStatsTiming) fGetEntrySeconds += ClockSeconds() - t0;
+#endif
+  if (fTree->GetTreeNumber() != fTreeNumber) TreeChanged();
   if (nbytes > 0) {
 #ifndef NO_BranchValue_STATS
     fTotRead += nbytes;
@@ -150,10 +469,59 @@ inline TTreeIterator::Fill_iterator TTreeIterator::FillEntries (Long64_t nfill/*
       Info ("TTreeIterator", "fill %lld entries into tree '%s' in file %s (%lld so far)", nfill, GetTree()->GetName(), GetTree()->GetDirectory()->GetName(), nentries);
     }
   }
+  if (fAutoFlush != 0 || fOptimizeBaskets > 0) {
+    // negative AutoFlush means flush each cluster when it reaches that many bytes
+    Long64_t autof = fAutoFlush != 0 ? fAutoFlush : -fOptimizeBaskets;
+    GetTree()->SetAutoFlush (autof);
+    if (verbose() >= 1) Info ("TTreeIterator", "set tree '%s' AutoFlush to %lld %s", GetTree()->GetName(), (autof<0?-autof:autof), (autof<0?"bytes":"entries"));
+  }
+  if (fCheckpointEntries > 0 || fCheckpointBytes > 0 || fCheckpointSeconds > 0.0) {
+    fLastCheckpointEntry = nentries;
+    fLastCheckpointFill  = fTotFill;
+    fLastCheckpointClock = ClockSeconds();
+  }
   return Fill_iterator (*this, nentries, nfill>=0 ? nentries+nfill : -1);
 }
 
 
+inline TTreeIterator::Fill_iterator TTreeIterator::FillEntries (Long64_t nfill, const Schema& schema) {
+  if (!GetTree()) return Fill_iterator (*this,0,0);
+  Long64_t nentries = GetTree()->GetEntries();
+  // Entry::SetAt(i) uses schema branch i as fBranches[i], so any branches we already have must be the schema's first ones
+  for (size_t i = 0; i < fBranches.size(); i++) {
+    if (i >= schema.size() || fBranches[i].fName != schema[i].first || fBranches[i].fType != schema[i].second.fType) {
+      if (verbose() >= 0) Error ("FillEntries", "branch #%zu '%s' is not schema branch #%zu: a schema must be applied before other branches are used",
+                                 i, fBranches[i].GetName(), i);
+      return Fill_iterator (*this,0,0);
+    }
+  }
+  // make sure the cache won't be reallocated while we create the branches
+  if (fBranches.capacity() < schema.size()) {
+    bool moved = !fBranches.empty();
+    fBranches.reserve (schema.size());
+    if (moved) SetBranchAddressAll();
+  }
+  const size_t nhave = fBranches.size();
+  for (size_t i = nhave; i < schema.size(); i++) {
+    schema[i].second.CreateBranch (*this, schema[i].first.c_str(), nentries);
+    if (fBranches.size() != i+1) {
+      if (verbose() >= 0) Error ("FillEntries", "could not create schema branch '%s'", schema[i].first.c_str());
+      return Fill_iterator (*this,0,0);
+    }
+  }
+  if (verbose() >= 1) Info ("TTreeIterator", "created %zu schema branches in tree '%s'", schema.size() - nhave, GetTree()->GetName());
+  return FillEntries (nfill);
+}
+
+
+template <typename T>
+inline /*static*/ TBranch* TTreeIterator::CreateSchemaBranch (TTreeIterator& tree, const char* name, Long64_t index, const BranchType& type) {
+  return tree.Branch<T> (name, index, type.fLeaflist.empty() ? nullptr : type.fLeaflist.c_str(),
+                         type.fBufsize    >= 0 ? type.fBufsize    : tree.fBufsize,
+                         type.fSplitlevel >= 0 ? type.fSplitlevel : tree.fSplitlevel);
+}
+
+
 template <typename T>
 inline TBranch* TTreeIterator::Branch (const char* name, Long64_t index, const char* leaflist, Int_t bufsize, Int_t splitlevel) {
   if (!GetTree()) {
@@ -168,6 +536,9 @@ inline TBranch* TTreeIterator::Branch (const char* name, Long64_t index, const c
 
 
 inline /*virtual*/ Int_t TTreeIterator::Fill() {
+#ifdef USE_TIMING_PROBES
+  ProbeScope probe (fProbes[kProbeFill]);
+#endif
   TTree* t = GetTree();
   if (!t) return 0;
 
@@ -194,6 +565,20 @@ inline /*virtual*/ Int_t TTreeIterator::Fill() {
       std::string allbranches = BranchNamesString();
       Info  ("Fill", "Filled %d bytes for branches: %s", nbytes, allbranches.c_str());
     }
+    // Once the first cluster has been flushed, we know the compressed size of each branch. TTree has then already
+    // resized the baskets for that cluster's size (and switched a byte AutoFlush to the cluster's entry count),
+    // so this replaces its choice with one for our memory budget.
+    if (fOptimizeBaskets > 0 && !fBasketsOptimized && t->GetAutoFlush() > 0 && t->GetEntries() >= t->GetAutoFlush()) {
+      t->OptimizeBaskets (fOptimizeBaskets, 1.1, (verbose() >= 2 ? "d" : ""));
+      fBasketsOptimized = true;
+      if (verbose() >= 1) Info ("Fill", "optimized basket sizes for %lld bytes after %lld entries", fOptimizeBaskets, t->GetEntries());
+    }
+    if (fCheckpointEntries > 0 || fCheckpointBytes > 0 || fCheckpointSeconds > 0.0) {
+      if ((fCheckpointEntries > 0 && t->GetEntries() - fLastCheckpointEntry >= fCheckpointEntries) ||
+          (fCheckpointBytes   > 0 && Long64_t(fTotFill - fLastCheckpointFill) >= fCheckpointBytes) ||
+          (fCheckpointSeconds > 0.0 && ClockSeconds() - fLastCheckpointClock >= fCheckpointSeconds))
+        Checkpoint();
+    }
   } else {
     if (verbose() >= 0) {
       std::string allbranches = BranchNamesString();
@@ -205,7 +590,48 @@ inline /*virtual*/ Int_t TTreeIterator::Fill() {
 }
 
 
+inline Long64_t TTreeIterator::Checkpoint() {
+  Long64_t nbytes = 0;
+  TTree* t = GetTree();
+  if (!t) return 0;
+  double start = ClockSeconds();
+  TFile* file = t->GetCurrentFile();
+  if (file && file->IsWritable()) {
+    Long64_t before = file->GetBytesWritten();
+    if (fCheckpointAutoSave) t->AutoSave ("SaveSelf;FlushBaskets");
+    else                     t->FlushBaskets();
+    nbytes = file->GetBytesWritten() - before;
+    double latency = ClockSeconds() - start;
+    fTotCheckpoint += nbytes;
+    fCheckpointTime += latency;
+    if (latency > fMaxCheckpointTime) fMaxCheckpointTime = latency;
+    ++fNcheckpoint;
+    if (verbose() >= 1) Info ("Checkpoint", "%s %lld entries: wrote %lld bytes in %.3f s", (fCheckpointAutoSave?"autosaved":"flushed"), t->GetEntries(), nbytes, latency);
+  }
+  fLastCheckpointEntry = t->GetEntries();
+  fLastCheckpointFill  = fTotFill;
+  fLastCheckpointClock = start;
+  return nbytes;
+}
+
+
+#ifdef USE_VALUE_ARENA
+inline bool TTreeIterator::RestoreValues (const std::vector<char>& buf) {
+  if (!fValueArena.RestorePod (buf)) {
+    if (verbose() >= 0) Error ("RestoreValues", "saved %zu bytes, but now have %zu bytes of trivially copyable values", buf.size(), fValueArena.PodSize());
+    return false;
+  }
+  for (auto& b : fBranches)
+    if (b.fIsPod) b.fUnset = false;
+  return true;
+}
+#endif
+
+
 inline Int_t TTreeIterator::Write (const char* name/*=0*/, Int_t option/*=0*/, Int_t bufsize/*=0*/) {
+#ifdef USE_TIMING_PROBES
+  ProbeScope probe (fProbes[kProbeWrite]);
+#endif
   Int_t nbytes = 0;
   TTree* t = GetTree();
   if (t && t->GetDirectory() && t->GetDirectory()->IsWritable()) {
@@ -217,6 +643,16 @@ inline Int_t TTreeIterator::Write (const char* name/*=0*/, Int_t option/*=0*/, I
 }
 
 
+inline int TTreeIterator::GetCompressionSettings (const char* name) const {
+  TString sname = name;
+  for (auto ic = fCompression.rbegin(), end = fCompression.rend(); ic != end; ++ic) {
+    TRegexp re (ic->first.c_str(), kTRUE);
+    if (sname.Index(re) != kNPOS) return ic->second;
+  }
+  return -1;
+}
+
+
 inline std::string TTreeIterator::BranchNamesString (bool include_children/*=true*/, bool include_inactive/*=false*/) {
   std::string str;
   auto allbranches = BranchNames (include_children, include_inactive);
@@ -265,7 +701,7 @@ inline /*static*/ const char* TTreeIterator::tname(const char* name/*=0*/) {
   if (!cname || !*cname) cname = type_name<T>();   // use ROOT's shorter name by preference, but fall back on cxxabi or type_info name
   if (!cname || !*cname) return name ? name : "";
   if (!name  || !*name)  return cname;
-  static std::string ret;  // keep here so the c_str() is still valid at the end (until the next call).
+  static thread_local std::string ret;  // keep here so the c_str() is still valid at the end (until the next call in this thread).
   ret.clear();
   ret.reserve(strlen(name)+strlen(cname)+3);
   ret = name;
@@ -323,8 +759,9 @@ inline TTreeIterator::BranchValue* TTreeIterator::GetBranch (const char* name, L
     if (!GetTree()) {
       if (verbose() >= 0) Error (tname<T>("Get"), "no tree available");
       return nullptr;
-    } else if (TBranch* branch = GetTree()->GetBranch(name)) {
-      ibranch->fBranch = branch;
+    } else if (TBranch* branch = GetTree()->GetBranch(name)) {   // also looks in friend trees
+      ibranch->SetBranch (branch);
+      if (ibranch->fIsFriend) branch->GetTree()->AddBranchToCache (branch->GetName(), true);
       if (!ibranch->SetBranchAddress<T>()) return nullptr;
     } else {
       if (verbose() >= 0) Error (tname<T>("Get"), "branch '%s' not found", name);
@@ -341,6 +778,9 @@ inline TTreeIterator::BranchValue* TTreeIterator::GetBranch (const char* name, L
 
 
 inline TTreeIterator::BranchValue* TTreeIterator::GetBranchValue (const char* name, type_code_t type) const {
+#ifdef USE_TIMING_PROBES
+  ProbeScope probe (fProbes[kProbeLookup]);
+#endif
   if (fTryLast) {
     ++fLastBranch;
     if (fLastBranch == fBranches.end()) fLastBranch = fBranches.begin();
@@ -348,6 +788,7 @@ inline TTreeIterator::BranchValue* TTreeIterator::GetBranchValue (const char* na
     if (b.fType == type && b.fName == name) {
 #ifndef NO_BranchValue_STATS
       ++fNhits;
+      ++StatsFor(&b).hits;
 #endif
       return &b;
     }
@@ -360,6 +801,7 @@ inline TTreeIterator::BranchValue* TTreeIterator::GetBranchValue (const char* na
       fLastBranch = ib;
 #ifndef NO_BranchValue_STATS
       ++fNmiss;
+      ++StatsFor(&b).misses;
 #endif
       return &b;
     }
@@ -419,6 +861,39 @@ inline TTreeIterator::BranchValue* TTreeIterator::NewBranch (const char* name, L
 }
 
 
+template <typename T, typename... Args>
+inline T* TTreeIterator::CreateValue (Args&&... args) const {
+#ifndef USE_VALUE_ARENA
+  return GetValuePool<T>().Create (std::forward<Args>(args)...);
+#else
+  return fValueArena.Create<T> (std::forward<Args>(args)...);
+#endif
+}
+
+
+template <typename T>
+inline T& TTreeIterator::default_value() const {
+  type_code_t type = type_code<T>();
+  for (auto& def : fDefaultValues)
+    if (def.first == type) return static_cast<ValueHolder<T>&>(*def.second).fValue;
+  fDefaultValues.emplace_back (type, std::unique_ptr<ValuePoolBase>(new ValueHolder<T>()));
+  return static_cast<ValueHolder<T>&>(*fDefaultValues.back().second).fValue;
+}
+
+
+#ifndef USE_VALUE_ARENA
+template <typename T>
+inline TTreeIterator::ValuePool<T>& TTreeIterator::GetValuePool() const {
+  type_code_t type = type_code<T>();
+  for (auto& pool : fValuePools)
+    if (pool.first == type) return static_cast<ValuePool<T>&>(*pool.second);
+  if (verbose() >= 2) Info (tname<T>("GetValuePool"), "new value pool for type '%s'", type_name<T>());
+  fValuePools.emplace_back (type, std::unique_ptr<ValuePoolBase>(new ValuePool<T>()));
+  return static_cast<ValuePool<T>&>(*fValuePools.back().second);
+}
+#endif
+
+
 template <typename T>
 inline TTreeIterator::BranchValue* TTreeIterator::NewBranchValue (const char* name, T&& val) const {
   fBranches.reserve (200);   // when we reallocate, SetBranchAddress will be invalidated so have to fix up each time. This is ignored after the first call.
@@ -443,6 +918,99 @@ inline void TTreeIterator::SetBranchAddressAll() const {
 }
 
 
+// For the lazy end(): entries before the end of the file containing index (index itself if that is past the end).
+// The TChain's offsets are used as far as they are known (from Add(name,nentries), the entries cache, or files
+// already read). Otherwise this loads the file containing index (as reading the entry would do next).
+inline Long64_t TTreeIterator::KnownEntries (Long64_t index) const {
+  TTree* t = GetTree();
+  if (!t) return 0;
+  auto chain = dynamic_cast<TChain*>(t);
+  if (!chain) return t->GetEntries();
+  const Long64_t* offset = chain->GetTreeOffset();
+  const Int_t ntrees = chain->GetNtrees();
+  Int_t i = 0;
+  while (i < ntrees && offset[i+1] >= offset[i] && offset[i+1] < TTree::kMaxEntries) i++;
+  if (index < offset[i] || i == ntrees) return offset[i];
+  if (chain->LoadTree (index) < 0) return index;
+  return chain->GetTreeOffset()[chain->GetTreeNumber()] + chain->GetTree()->GetEntries();
+}
+
+
+// Called when we move to a new tree (TChain file). TChain sets the branch addresses in the new tree, but our TBranch
+// pointers are to the old one, so look them all up now, rather than on the first access in the new file.
+// Files in a chain usually have the same layout, so fBindPlan remembers where each branch was in the last tree's
+// list of branches, and its type. If the new tree has the same number of branches, and the branch at that position
+// has the same name and type, we take it directly. Otherwise (or for sub-branches) look it up by name.
+inline void TTreeIterator::TreeChanged() const {
+  TTree* t = GetTree();
+  fTreeNumber = t->GetTreeNumber();
+  TObjArray* list = t->GetListOfBranches();   // TChain forwards to the current tree
+  const Int_t nlist = list ? list->GetEntriesFast() : 0;
+  const bool sameLayout = (nlist == fBindNbranches);
+  fBindNbranches = nlist;
+  if (fBindPlan.size() < fBranches.size()) fBindPlan.resize (fBranches.size(), BindSlot{-1,""});
+  size_t nbranches = 0, nplan = 0;
+  for (size_t i = 0; i < fBranches.size(); i++) {
+    auto& b = fBranches[i];
+    if (!b.fBranch) continue;
+    nbranches++;
+    auto& slot = fBindPlan[i];
+    TBranch* branch = nullptr;
+    if (sameLayout && slot.pos >= 0) {
+      auto br = static_cast<TBranch*>(list->UncheckedAt (slot.pos));
+      if (br && strcmp (br->GetName(), b.GetName()) == 0 && slot.type == BranchTypeName (br)) {
+        branch = br;
+        nplan++;
+      }
+    }
+    if (!branch) {
+      branch = t->GetBranch (b.GetName());   // TChain::GetBranch looks in the current tree
+      slot.pos = (branch && list) ? list->IndexOf (branch) : -1;   // -1 for sub-branches
+      slot.type = branch ? BranchTypeName (branch) : "";
+    }
+    b.SetBranch (branch);
+    if (!b.fBranch) {
+      if (verbose() >= 0) Error ("TreeChanged", "branch '%s' not found in tree #%d", b.GetName(), fTreeNumber);
+      b.fHaveAddr = false;
+    }
+  }
+  if (verbose() >= 1 && nbranches > 0) Info ("TreeChanged", "rebound %zu branches in tree #%d, %zu by position", nbranches, fTreeNumber, nplan);
+  ReleaseAsyncOpen();   // if we didn't move to the file we started opening
+  if (!fAsyncOpen || fAsyncNext == fTreeNumber + 1) return;
+  if (auto chain = dynamic_cast<TChain*>(t)) {
+    TObjArray* files = chain->GetListOfFiles();
+    if (fTreeNumber + 1 >= files->GetEntriesFast()) return;
+    fAsyncNext = fTreeNumber + 1;
+    fAsyncFile = files->UncheckedAt(fAsyncNext)->GetTitle();   // TChainElement title is the file name
+    if (verbose() >= 1) Info ("TreeChanged", "start opening file #%d: %s", fAsyncNext, fAsyncFile.c_str());
+    TFile::AsyncOpen (fAsyncFile.c_str());   // picked up by TFile::Open when TChain::LoadTree gets there
+  }
+}
+
+
+// An AsyncOpen request stays in TFile's list until that file is opened, so if the chain didn't get there, open and
+// close it now. If TChain::LoadTree did open it, the request has already gone from the list.
+inline void TTreeIterator::ReleaseAsyncOpen() const {
+  if (fAsyncFile.empty()) return;
+  if (TFile::GetAsyncOpenStatus (fAsyncFile.c_str()) != TFile::kAOSNotAsync) {
+    if (verbose() >= 1) Info ("ReleaseAsyncOpen", "file #%d was not read: %s", fAsyncNext, fAsyncFile.c_str());
+    delete TFile::Open (fAsyncFile.c_str());   // uses (and removes) the pending request
+  }
+  fAsyncFile.clear();
+  fAsyncNext = -1;
+}
+
+
+// Class name, or leaf type for a simple branch: enough to tell if a branch with the same name has changed type.
+inline /*static*/ const char* TTreeIterator::BranchTypeName (TBranch* branch) {
+  const char* cname = branch->GetClassName();
+  if (cname && *cname) return cname;
+  TObjArray* leaves = branch->GetListOfLeaves();
+  if (!leaves || leaves->GetEntriesFast() != 1) return "";
+  return static_cast<TLeaf*>(leaves->UncheckedAt(0))->GetTypeName();
+}
+
+
 template <typename T>
 inline Int_t TTreeIterator::FillBranch (TBranch* branch, const char* name, Long64_t index) {
   Int_t nbytes = branch->Fill();
@@ -460,6 +1028,23 @@ inline Int_t TTreeIterator::FillBranch (TBranch* branch, const char* name, Long6
 
 // TTreeIterator::Entry ========================================================
 
+template <typename T>
+inline T& TTreeIterator::Entry::Get (const char* name) const {
+  if (BranchValue* ibranch = tree().GetBranch<T> (name, fIndex, fLocalIndex))
+    if (const T* pval = ibranch->GetBranchValue<T>()) return const_cast<T&>(*pval);
+  return tree().default_value<remove_cvref_t<T>>();
+}
+
+
+template <typename T>
+inline T TTreeIterator::Entry::Value (const char* name) const {
+  static_assert (std::is_trivially_copyable<T>::value, "Value<T>() returns a copy, so is only for trivially-copyable types - use Get<T>()");
+  if (BranchValue* ibranch = tree().GetBranch<T> (name, fIndex, fLocalIndex))
+    if (const T* pval = ibranch->GetBranchValue<T>()) return *pval;
+  return type_default<T>();
+}
+
+
 template <typename T>
 inline const T& TTreeIterator::Entry::Get (const char* name, const T& def) const {
   if (BranchValue* ibranch = tree().GetBranch<T> (name, fIndex, fLocalIndex))
@@ -476,23 +1061,59 @@ inline const T& TTreeIterator::Entry::Set (const char* name, T&& val, const char
     return ibranch->Set<T>(std::forward<T>(val));
   }
   BranchValue* ibranch = tree().NewBranch<T> (name, fIndex, std::forward<T>(val), leaflist, bufsize, splitlevel);
-  if (!ibranch) return default_value<V>();
+  if (!ibranch) return tree().default_value<V>();
   return ibranch->GetValue<V>();
 }
 
 
+template <typename T>
+inline T& TTreeIterator::Entry::Modify (const char* name, const char* leaflist, Int_t bufsize, Int_t splitlevel) {
+  if (BranchValue* ibranch = tree().GetBranchValue<T> (name)) {
+    return ibranch->Modify<T>();
+  }
+  T def = type_default<T>();
+  BranchValue* ibranch = tree().NewBranch<T> (name, fIndex, std::move(def), leaflist, bufsize, splitlevel);
+  if (!ibranch) return tree().default_value<T>();
+  return ibranch->Modify<T>();
+}
+
+
+template <typename T>
+inline const T& TTreeIterator::Entry::SetAt (std::size_t ibranch, T&& val) {
+#ifndef FEWER_CHECKS
+  using V = remove_cvref_t<T>;
+  if (ibranch >= tree().fBranches.size() || tree().fBranches[ibranch].fType != type_code<V>()) {
+    if (verbose() >= 0) tree().Error (tname<T>("SetAt"), "no branch #%zu of type '%s'", ibranch, type_name<T>());
+    return tree().default_value<V>();
+  }
+#endif
+  return tree().fBranches[ibranch].Set<T>(std::forward<T>(val));
+}
+
+
 // TTreeIterator::BranchValue ==================================================
 
 template <typename T>
 inline TTreeIterator::BranchValue::BranchValue (TTreeIterator& tree, const char* name, T&& value)
   : fName(name),
-    fValue(std::forward<T>(value)),
+    fType(type_code<remove_cvref_t<T>>()),
     fTreeI(tree)
 {
   using V = remove_cvref_t<T>;
-  fType = type_code<V>();
+  SetValue<T>(std::forward<T>(value));
   fSetDefaultValue = &BranchValue::SetDefaultValue<V>;
   fSetValueAddress = &BranchValue::SetValueAddress<V>;
+  fCloneBranch     = &BranchValue::CloneBranch<V>;
+#ifdef USE_VALUE_ARENA
+  fIsPod = std::is_trivially_copyable<V>::value;
+#endif
+}
+
+
+template <typename T>
+inline T& TTreeIterator::BranchValue::Get() const {
+  if (const T* pval = GetBranchValue<T>()) return const_cast<T&>(*pval);
+  return tree().default_value<remove_cvref_t<T>>();
 }
 
 
@@ -520,7 +1141,8 @@ inline const T& TTreeIterator::BranchValue::Set(T&& val) {
 #endif
       } else
 #endif
-        if (!fPvalue) {
+        if (!fPvalue || reuses_capacity<V>::value) {
+          // Assign in place. A container will reuse its existing capacity, rather than reallocating.
 //        if (verbose() >= 3) tree().Info (tname<T>("Set"), "branch '%s' assign value to @%p", GetName(), (void*)GetValuePtr<V>());
           return GetValue<V>() = std::forward<T>(val);
         } else {
@@ -549,6 +1171,17 @@ inline const T& TTreeIterator::BranchValue::Set(T&& val) {
 }
 
 
+template <typename T>
+inline T& TTreeIterator::BranchValue::Modify() {
+  // GetBranchValue() takes care of user-supplied addresses
+  if (const T* pval = GetBranchValue<T>()) {
+    fUnset = false;
+    return const_cast<T&>(*pval);
+  }
+  return tree().default_value<T>();
+}
+
+
 template <typename T>
 inline void TTreeIterator::BranchValue::CreateBranch (const char* leaflist, Int_t bufsize, Int_t splitlevel) {
   using V = remove_cvref_t<T>;
@@ -591,6 +1224,11 @@ inline void TTreeIterator::BranchValue::CreateBranch (const char* leaflist, Int_
     }
     if   (verbose() >= 1) tree().Info  (tname<T>("Set"), "create branch '%s' %s of type '%s' @%p",       GetName(), (fIsObj?"object":"variable"), type_name<T>(), addr);
   }
+  int compress = tree().GetCompressionSettings (GetName());
+  if (compress >= 0) {
+    fBranch->SetCompressionSettings (compress);
+    if (verbose() >= 1) tree().Info (tname<T>("Set"), "branch '%s' compression settings %d", GetName(), compress);
+  }
   fHaveAddr = true;
 }
 
@@ -605,8 +1243,35 @@ inline Int_t TTreeIterator::BranchValue::GetBranch (Long64_t index, Long64_t loc
     if (verbose() >= 3) tree().Info  ("GetBranch", "branch '%s' already read from entry %lld",           GetName(),        index);
     return 0;
   }
+  if (fIsFriend) {
+    localIndex = fBranch->GetTree()->GetReadEntry();   // set by TTree::LoadTreeFriend when we loaded index
+    if (localIndex < 0) {   // no matching entry in indexed friend
+      if (verbose() >= 1) tree().Info  ("GetBranch", "friend branch '%s' has no entry for entry %lld",  GetName(),        index);
+      fLastGet = -1;
+      return -1;
+    }
+  }
+#endif
+#ifdef USE_TIMING_PROBES
+  ProbeScope probe (tree().fProbes[kProbeRead]);
+#endif
+#ifndef NO_BranchValue_STATS
+  BranchStats& stats = tree().StatsFor (this);
+  const Int_t basket = fBranch->GetReadEntry() >= 0 ? fBranch->GetReadBasket() : -1;   // -1 if nothing read yet from this TBranch
+  const double t0 = tree().fStatsTiming ? ClockSeconds() : 0.0;
 #endif
   Int_t nread = fBranch->GetEntry (localIndex, 1);
+#ifndef NO_BranchValue_STATS
+  stats.calls++;
+  if (nread > 0) stats.bytes += nread;
+  const bool newBasket = (fBranch->GetReadBasket() != basket);
+  if (newBasket) stats.baskets++;
+  if (tree().fStatsTiming) {
+    double dt = ClockSeconds() - t0;
+    stats.seconds += dt;
+    if (newBasket) stats.basketSeconds += dt;
+  }
+#endif
   if (nread < 0) {
     if (verbose() >= 0) tree().Error ("GetBranch", "GetEntry failed for branch '%s', entry %lld (%lld)", GetName(),        index, localIndex);
   } else if (nread == 0) {
@@ -697,6 +1362,12 @@ inline bool TTreeIterator::BranchValue::SetBranchAddress() {
 }
 
 
+inline void TTreeIterator::BranchValue::SetBranch (TBranch* branch) {
+  fBranch = branch;
+  fIsFriend = branch && branch->GetTree() != GetTree()->GetTree();   // TChain::GetTree() is the current file's tree
+}
+
+
 inline void TTreeIterator::BranchValue::ResetAddress() {
   if (fBranch && fHaveAddr
 #ifndef OVERRIDE_BRANCH_ADDRESS
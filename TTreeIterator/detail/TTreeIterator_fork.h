@@ -0,0 +1,169 @@
+// Multi-process entry loops for TTreeIterator, for user code that can't run in several threads.
+// Each worker is a fork()ed copy of this process, with its own TFile/TChain handle (from CloneForThread).
+// Results are passed back in temporary files, and progress in a shared memory counter for each worker.
+
+#ifndef ROOT_TTreeIterator_fork
+#define ROOT_TTreeIterator_fork
+
+#include <cstdio>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#include "TSystem.h"
+#include "TList.h"
+
+template <typename Fn, typename... Objs>
+inline Long64_t TTreeIterator::ForkForEach (int nprocs, Fn&& fn, Objs&... objs) {
+  const auto ranges = ClusterRanges();
+  nprocs = ParallelThreads (nprocs, ranges.size());
+#ifdef _WIN32
+  nprocs = 1;
+#endif
+  if (nprocs <= 1) {
+    Long64_t nentries = 0;
+    for (auto& entry : *this) {
+      fn (entry);
+      nentries++;
+    }
+    return nentries;
+  }
+#ifndef _WIN32
+  Long64_t total = 0;
+  for (auto& r : ranges) total += r.second - r.first;
+  const auto blocks = SplitRanges (ranges, nprocs);
+
+  // each worker's count of processed entries, shared with the parent
+  const size_t shared_size = nprocs * sizeof(std::atomic<Long64_t>);
+  void* shared = mmap (nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    if (verbose() >= 0) Error ("ForkForEach", "could not allocate shared memory for %d workers", nprocs);
+    return -1;
+  }
+  auto progress = static_cast<std::atomic<Long64_t>*>(shared);
+  for (int i = 0; i < nprocs; i++) ::new (static_cast<void*>(&progress[i])) std::atomic<Long64_t>(0);
+
+  if (verbose() >= 1) Info ("ForkForEach", "process %lld entries in %zu clusters with %d processes", total, ranges.size(), nprocs);
+  std::string tmpname = Form ("%s/TTreeIterator_%d_", gSystem->TempDirectory(), gSystem->GetPid());
+  std::vector<std::string> outnames;
+  std::vector<pid_t> pids (nprocs, -1);
+  std::fflush (stdout);   // so buffered output isn't repeated by each worker
+  std::fflush (stderr);
+  bool failed = false;
+  for (int i = 0; i < nprocs; i++) {
+    outnames.push_back (tmpname + std::to_string(i) + ".root");
+    pid_t pid = fork();
+    if (pid == 0) _exit (ForkWorker (ranges, blocks[i], outnames[i], progress[i], fn, objs...));   // skip atexit and static destructors
+    if (pid < 0) {
+      if (verbose() >= 0) Error ("ForkForEach", "could not fork worker %d", i);
+      failed = true;
+    }
+    pids[i] = pid;
+  }
+
+  for (int npoll = 1, nrunning = nprocs; nrunning > 0; npoll++) {
+    nrunning = 0;
+    for (int i = 0; i < nprocs; i++) {
+      if (pids[i] <= 0) continue;
+      int status = 0;
+      if (waitpid (pids[i], &status, WNOHANG) == pids[i]) {
+        if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+          if (verbose() >= 0) Error ("ForkForEach", "worker %d failed with status %d", i, status);
+          failed = true;
+        }
+        pids[i] = 0;
+      } else
+        nrunning++;
+    }
+    if (nrunning == 0) break;
+    if (verbose() >= 1 && npoll % 10 == 0) {
+      Long64_t done = 0;
+      for (int i = 0; i < nprocs; i++) done += progress[i];
+      Info ("ForkForEach", "processed %lld of %lld entries (%.0f%%), %d workers running", done, total, (total ? 100.0*done/total : 100.0), nrunning);
+    }
+    gSystem->Sleep (100);
+  }
+
+  Long64_t nentries = 0;
+  if (!failed) {   // don't merge a partial result
+    std::vector<std::unique_ptr<TFile>> files;
+    for (int i = 0; i < nprocs && !failed; i++) {
+      nentries += progress[i];
+      if (sizeof...(Objs) == 0) continue;
+      files.emplace_back (TFile::Open (outnames[i].c_str()));
+      if (!files.back() || files.back()->IsZombie()) {
+        if (verbose() >= 0) Error ("ForkForEach", "could not open worker %d output file %s", i, outnames[i].c_str());
+        failed = true;
+        continue;
+      }
+      for (size_t j = 0; j < sizeof...(Objs); j++) {   // check them all before merging any
+        if (files.back()->GetKey (Form ("obj%zu", j))) continue;
+        if (verbose() >= 0) Error ("ForkForEach", "worker %d output file %s has no obj%zu", i, outnames[i].c_str(), j);
+        failed = true;
+      }
+    }
+    if (!failed) {
+      int index = 0;
+      int expand[] = {0, (MergeObject (objs, index++, files), 0)...};   // in order
+      (void)expand;
+    }
+  }
+  for (auto& name : outnames) gSystem->Unlink (name.c_str());
+  munmap (shared, shared_size);
+  if (failed) return -1;
+  if (verbose() >= 1) Info ("ForkForEach", "processed %lld of %lld entries", nentries, total);
+  return nentries;
+#endif
+}
+
+
+// Body of worker process: returns its exit status.
+template <typename Fn, typename... Objs>
+inline int TTreeIterator::ForkWorker (const std::vector<std::pair<Long64_t,Long64_t>>& ranges, std::pair<size_t,size_t> block,
+                                      const std::string& outname, std::atomic<Long64_t>& progress, Fn& fn, Objs&... objs) {
+  try {
+    int expand[] = {0, (ResetObject (objs, 0), 0)...};
+    (void)expand;
+    {
+      std::unique_ptr<TTreeIterator> iter = CloneForThread();   // don't share the parent's file offsets
+      if (!iter) {
+        if (verbose() >= 0) Error ("ForkForEach", "worker could not open tree '%s'", GetName());
+        return 2;
+      }
+      for (size_t itask = block.first; itask < block.second; itask++) {
+        Long64_t first = ranges[itask].first, last = ranges[itask].second;
+        for (Entry_iterator it (*iter, first, last), end (*iter, last, last); it != end; ++it)
+          fn (*it);
+        progress += last - first;
+      }
+    }
+    if (sizeof...(Objs) == 0) return 0;
+    TFile out (outname.c_str(), "recreate");
+    if (out.IsZombie()) return 3;
+    int index = 0;
+    int written[] = {0, out.WriteTObject (&objs, Form ("obj%d", index++))...};
+    (void)written;
+    out.Close();
+    return 0;
+  } catch (const std::exception& e) {
+    if (verbose() >= 0) Error ("ForkForEach", "worker exception: %s", e.what());
+  } catch (...) {
+    if (verbose() >= 0) Error ("ForkForEach", "worker exception");
+  }
+  return 1;
+}
+
+
+// Merge the workers' copies of obj into obj
+template <typename Obj>
+inline /*static*/ void TTreeIterator::MergeObject (Obj& obj, int index, const std::vector<std::unique_ptr<TFile>>& files) {
+  TList list;
+  list.SetOwner();   // delete the copies afterwards. Those attached to a file (eg. TH1, TTree) detach themselves.
+  for (auto& file : files)
+    if (TObject* o = file->Get (Form ("obj%d", index)))   // ForkForEach checked they are all there
+      list.Add (o);
+  if (list.GetSize() > 0) obj.Merge (&list);
+}
+
+#endif /* ROOT_TTreeIterator_fork */
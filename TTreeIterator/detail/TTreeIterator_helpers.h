@@ -72,7 +72,7 @@ namespace _static_assert_detail
 
 inline const char* demangle_name (const char* name, const char* varname=0)
 {
-  static std::string r;   // only store one at a time
+  static thread_local std::string r;   // only store one at a time (per thread)
 #ifndef NO_cxxabi_h
   std::unique_ptr<char, void(*)(void*)> own(abi::__cxa_demangle(name, nullptr, nullptr, nullptr), std::free);
   r = own ? own.get() : name;
@@ -88,7 +88,7 @@ inline const char* demangle_name (const char* name, const char* varname=0)
 template <class T>
 inline const char* type_name (const char* varname=0)
 {
-  static std::string r;   // keeps one string per type (T) until exit
+  static thread_local std::string r;   // keeps one string per type (T) and thread until exit
   typedef typename std::remove_reference<T>::type TR;
   r = demangle_name (typeid(TR).name());
   if      (std::is_const           <TR>::value) r += " const";
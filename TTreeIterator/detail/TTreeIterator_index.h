@@ -0,0 +1,239 @@
+// Hashed index from key branch values (eg. run and event number) to entry number, for TTreeIterator::Find.
+// Unlike TTreeIndex, which keeps sorted arrays of the major and minor values and the entry numbers,
+// this keeps a 64-bit word and a 32-bit fingerprint per slot, and can be saved in a sidecar file to skip rebuilding.
+
+#ifndef ROOT_TTreeIterator_index
+#define ROOT_TTreeIterator_index
+
+#include <fstream>
+#include <sstream>
+#include "TLeaf.h"
+#include "TSystem.h"
+#include "TChainElement.h"
+
+inline bool TTreeIterator::BuildIndex (const std::vector<std::string>& keys, const char* fname/*=nullptr*/) {
+  TTree* t = GetTree();
+  if (!t) {
+    if (verbose() >= 0) Error ("BuildIndex", "no tree available");
+    return false;
+  }
+  if (keys.empty()) {
+    if (verbose() >= 0) Error ("BuildIndex", "no key branches given");
+    return false;
+  }
+  fIndexKeys = keys;
+  if (fname && *fname && LoadIndex (fname)) return true;
+
+  Long64_t nentries = t->GetEntries();
+  int ebits = 1;
+  while (ebits < 62 && (Long64_t(1) << ebits) <= nentries) ebits++;   // room for entry+1
+  fIndexEntryMask = (ULong64_t(1) << ebits) - 1;
+  fIndexTable.assign (size_t(nentries / 0.75) + 1, 0);   // at most 75% full
+  fIndexCheck.assign (fIndexTable.size(), 0);
+  const size_t nslots = fIndexTable.size();
+
+  std::vector<TLeaf*> leaves;
+  std::vector<Long64_t> vals (keys.size()), other (keys.size());
+  Int_t treenumber = -1;
+  size_t nverify = 0, ndup = 0;
+  bool ok = true;
+  for (Long64_t i = 0; ok && i < nentries; i++) {
+    if (!(ok = ReadKeys (i, leaves, treenumber, vals.data()))) break;
+    const ULong64_t h = KeyHash (vals.data(), vals.size()), tag = h & ~fIndexEntryMask;
+    const UInt_t fp = KeyFingerprint (vals.data(), vals.size());
+    UInt_t verify = 0;
+    bool dup = false;
+    size_t s = h % nslots;
+    for (; fIndexTable[s]; s = (s+1 == nslots ? 0 : s+1)) {   // linear probing
+      if ((fIndexTable[s] & ~fIndexEntryMask) != tag || (fIndexCheck[s] & ~kIndexVerify) != fp) continue;
+      // Same hash bits and fingerprint: the same key again (keep the first entry), or a different key,
+      // in which case both will have to be checked against the tree
+      if (!(ok = ReadKeys (Long64_t(fIndexTable[s] & fIndexEntryMask) - 1, leaves, treenumber, other.data()))) break;
+      if (other == vals) {
+        dup = true;
+        break;
+      }
+      fIndexCheck[s] |= kIndexVerify;
+      verify = kIndexVerify;
+      nverify++;
+    }
+    if (!ok || dup) {
+      ndup += dup;
+      continue;
+    }
+    fIndexTable[s] = tag | ULong64_t(i+1);
+    fIndexCheck[s] = fp | verify;
+  }
+  ForgetReads();
+  if (!ok) {
+    fIndexTable.clear();
+    fIndexCheck.clear();
+    return false;
+  }
+  if (verbose() >= 1) Info ("BuildIndex", "indexed %lld entries in %zu slots (%.1f MB)", nentries, nslots, 1e-6 * nslots * (sizeof(ULong64_t) + sizeof(UInt_t)));
+  if (verbose() >= 1 && (ndup || nverify)) Info ("BuildIndex", "%zu entries repeat an earlier key, %zu keys share a fingerprint", ndup, nverify);
+  if (fname && *fname) SaveIndex (fname);
+  return true;
+}
+
+
+inline Long64_t TTreeIterator::FindEntry (const std::vector<Long64_t>& keys) const {
+  if (fIndexTable.empty()) {
+    if (verbose() >= 0) Error ("Find", "no index - call BuildIndex first");
+    return -1;
+  }
+  if (keys.size() != fIndexKeys.size()) {
+    if (verbose() >= 0) Error ("Find", "%zu keys given for index with %zu keys", keys.size(), fIndexKeys.size());
+    return -1;
+  }
+  const ULong64_t h = KeyHash (keys.data(), keys.size()), tag = h & ~fIndexEntryMask;
+  const UInt_t fp = KeyFingerprint (keys.data(), keys.size());
+  const size_t nslots = fIndexTable.size();
+  std::vector<TLeaf*> leaves;
+  std::vector<Long64_t> vals (keys.size());
+  Int_t treenumber = -1;
+  Long64_t found = -1;
+  for (size_t s = h % nslots; fIndexTable[s]; s = (s+1 == nslots ? 0 : s+1)) {
+    ULong64_t w = fIndexTable[s];
+    if ((w & ~fIndexEntryMask) != tag || (fIndexCheck[s] & ~kIndexVerify) != fp) continue;
+    Long64_t i = Long64_t(w & fIndexEntryMask) - 1;
+    if (!(fIndexCheck[s] & kIndexVerify)) {   // no other indexed key has this hash and fingerprint
+      found = i;
+      break;
+    }
+    if (!ReadKeys (i, leaves, treenumber, vals.data())) break;
+    if (vals == keys) {
+      found = i;
+      break;
+    }
+    if (verbose() >= 2) Info ("Find", "entry %lld has the same hash tag, but different keys", i);
+  }
+  if (treenumber >= 0) ForgetReads();
+  if (verbose() >= 2) Info ("Find", "found entry %lld", found);
+  return found;
+}
+
+
+// Read the key values for entry index into vals, looking up the key leaves again when we move to another file.
+inline bool TTreeIterator::ReadKeys (Long64_t index, std::vector<TLeaf*>& leaves, Int_t& treenumber, Long64_t* vals) const {
+  TTree* t = GetTree();
+  Long64_t local = t->LoadTree (index);
+  if (local < 0) {
+    if (verbose() >= 0) Error ("BuildIndex", "could not load entry %lld", index);
+    return false;
+  }
+  if (t->GetTreeNumber() != treenumber || leaves.empty()) {
+    treenumber = t->GetTreeNumber();
+    if (treenumber != fTreeNumber) fTreeNumber = -1;   // TChain may close the file our TBranch pointers are in
+    leaves.clear();
+    for (auto& key : fIndexKeys) {
+      TLeaf* leaf = t->GetLeaf (key.c_str());
+      if (!leaf) {
+        if (verbose() >= 0) Error ("BuildIndex", "key branch '%s' not found", key.c_str());
+        return false;
+      }
+      leaves.push_back (leaf);
+    }
+  }
+  for (size_t k = 0; k < leaves.size(); k++) {
+    if (leaves[k]->GetBranch()->GetEntry (local, 1) < 0) return false;   // getall=1 reads even if the branch is disabled
+    vals[k] = leaves[k]->GetValueLong64();
+  }
+  return true;
+}
+
+
+// ReadKeys may have read into our branches' addresses, so they have to be read again
+inline void TTreeIterator::ForgetReads() const {
+#ifndef USE_TTREE_GETENTRY
+  for (auto& b : fBranches) b.fLastGet = -1;
+#endif
+}
+
+
+inline /*static*/ ULong64_t TTreeIterator::KeyHash (const Long64_t* keys, size_t nkeys, ULong64_t seed/*=0x9E3779B97F4A7C15ULL*/) {
+  ULong64_t h = seed;
+  for (size_t k = 0; k < nkeys; k++) {   // splitmix64 finaliser for each key
+    h ^= ULong64_t(keys[k]);
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+  }
+  return h;
+}
+
+
+// Sidecar file: a text header line, then the table and fingerprints in native byte order
+inline bool TTreeIterator::SaveIndex (const char* fname) const {
+  if (fIndexTable.empty()) return false;
+  std::ofstream out (fname, std::ios::binary | std::ios::trunc);
+  out << "TTreeIterator-index-2\t" << GetName() << '\t' << (GetTree() ? GetTree()->GetEntries() : 0) << '\t' << fIndexKeys.size();
+  for (auto& key : fIndexKeys) out << '\t' << key;
+  out << '\t' << fIndexEntryMask << '\t' << fIndexTable.size() << '\n';
+  out.write (reinterpret_cast<const char*>(fIndexTable.data()), fIndexTable.size() * sizeof(ULong64_t));
+  out.write (reinterpret_cast<const char*>(fIndexCheck.data()), fIndexCheck.size() * sizeof(UInt_t));
+  if (!out) {
+    if (verbose() >= 0) Error ("SaveIndex", "could not write index file %s", fname);
+    return false;
+  }
+  if (verbose() >= 1) Info ("SaveIndex", "saved index to %s", fname);
+  return true;
+}
+
+
+// Load the index from fname, if it is for the same tree and keys, and newer than the tree's files
+inline bool TTreeIterator::LoadIndex (const char* fname) {
+  FileStat_t ist;
+  if (gSystem->GetPathInfo (fname, ist) != 0) return false;
+  TTree* t = GetTree();
+  std::vector<std::string> files;
+  if (auto chain = dynamic_cast<TChain*>(t)) {
+    TObjArray* elements = chain->GetListOfFiles();
+    for (Int_t i = 0, n = elements->GetEntriesFast(); i < n; i++) files.push_back (elements->UncheckedAt(i)->GetTitle());
+  } else if (TFile* file = t->GetCurrentFile()) {
+    files.push_back (file->GetName());
+  } else {
+    return false;   // in-memory tree could have changed
+  }
+  for (auto& f : files) {
+    FileStat_t st;
+    if (gSystem->GetPathInfo (f.c_str(), st) != 0 || st.fMtime > ist.fMtime) {
+      if (verbose() >= 1) Info ("BuildIndex", "index file %s is older than %s", fname, f.c_str());
+      return false;
+    }
+  }
+
+  std::ifstream in (fname, std::ios::binary);
+  std::string line;
+  if (!std::getline (in, line)) return false;
+  std::istringstream hs (line);
+  std::string magic, tname, key;
+  Long64_t nentries = -1;
+  size_t nkeys = 0, nslots = 0;
+  ULong64_t mask = 0;
+  std::getline (hs, magic, '\t');
+  std::getline (hs, tname, '\t');
+  hs >> nentries >> nkeys;
+  bool ok = (magic == "TTreeIterator-index-2" && tname == GetName() && nkeys == fIndexKeys.size());
+  hs.ignore (1);
+  for (size_t k = 0; ok && k < nkeys; k++) ok = std::getline (hs, key, '\t') && key == fIndexKeys[k];
+  ok = ok && (hs >> mask >> nslots) && nslots > 0 && nentries == t->GetEntries();
+  if (!ok) {
+    if (verbose() >= 1) Info ("BuildIndex", "index file %s does not match tree '%s' with keys given", fname, GetName());
+    return false;
+  }
+  fIndexTable.resize (nslots);
+  fIndexCheck.resize (nslots);
+  if (!in.read (reinterpret_cast<char*>(fIndexTable.data()), nslots * sizeof(ULong64_t)) ||
+      !in.read (reinterpret_cast<char*>(fIndexCheck.data()), nslots * sizeof(UInt_t))) {
+    if (verbose() >= 0) Error ("BuildIndex", "could not read index file %s", fname);
+    fIndexTable.clear();
+    fIndexCheck.clear();
+    return false;
+  }
+  fIndexEntryMask = mask;
+  if (verbose() >= 1) Info ("BuildIndex", "loaded index of %lld entries from %s", nentries, fname);
+  return true;
+}
+
+#endif /* ROOT_TTreeIterator_index */
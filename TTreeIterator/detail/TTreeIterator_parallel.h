@@ -0,0 +1,436 @@
+// Multi-threaded entry loops for TTreeIterator.
+// Each worker thread has its own TFile/TChain handle and its own TTreeIterator (with its own BranchValue cache),
+// so per-entry code is the same as in a range-for loop over a single TTreeIterator.
+
+#ifndef ROOT_TTreeIterator_parallel
+#define ROOT_TTreeIterator_parallel
+
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <tuple>
+#include <stdexcept>
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TFile.h"
+#include "TChainElement.h"
+
+// Entry ranges [first,last) for each cluster of the tree, or of each file in the chain.
+inline std::vector<std::pair<Long64_t,Long64_t>> TTreeIterator::ClusterRanges() const {
+  std::vector<std::pair<Long64_t,Long64_t>> ranges;
+  TTree* t = GetTree();
+  if (!t) return ranges;
+  Long64_t nentries = t->GetEntries();   // for a TChain, this opens each file to fill GetTreeOffset()
+  if (auto chain = dynamic_cast<TChain*>(t)) {
+    ReleaseAsyncOpen();   // we are about to open every file
+    const Long64_t* offset = chain->GetTreeOffset();
+    for (Int_t i = 0, n = chain->GetNtrees(); i < n; i++) {
+      if (chain->LoadTree (offset[i]) < 0) break;
+      TTree* tree = chain->GetTree();
+      Long64_t ntree = tree->GetEntries();
+      auto clusters = tree->GetClusterIterator(0);
+      for (Long64_t first; (first = clusters()) < ntree;)
+        ranges.emplace_back (offset[i] + first, offset[i] + std::min (clusters.GetNextEntry(), ntree));
+    }
+    fTreeNumber = -1;   // we moved the chain, so TreeChanged must look up our branches again
+  } else {
+    auto clusters = t->GetClusterIterator(0);
+    for (Long64_t first; (first = clusters()) < nentries;)
+      ranges.emplace_back (first, std::min (clusters.GetNextEntry(), nentries));
+  }
+  if (verbose() >= 1) Info ("ClusterRanges", "%lld entries in %zu clusters", nentries, ranges.size());
+  return ranges;
+}
+
+
+// Open a new handle on our tree or chain, for use by another thread.
+// owner is set to the TFile or TChain that must be deleted afterwards. Returns nullptr for an in-memory tree.
+inline TTree* TTreeIterator::OpenTreeHandle (std::unique_ptr<TObject>& owner) const {
+  TTree* t = GetTree();
+  if (!t) return nullptr;
+  if (auto chain = dynamic_cast<TChain*>(t)) {
+    TChain* wchain = new TChain (chain->GetName(), chain->GetTitle());
+    owner.reset (wchain);
+    TObjArray* files = chain->GetListOfFiles();
+    for (Int_t i = 0, n = files->GetEntriesFast(); i < n; i++) {
+      auto element = static_cast<TChainElement*>(files->UncheckedAt(i));
+      wchain->AddFile (element->GetTitle(), element->GetEntries(), element->GetName());   // title is the file name
+    }
+    return wchain;
+  }
+  TDirectory* dir = t->GetDirectory();
+  TFile* file = dir ? dir->GetFile() : nullptr;
+  if (!file) return nullptr;
+  std::string path = dir->GetPath();     // "file.root:/subdir"
+  std::string::size_type colon = path.find (":/");
+  std::string key = (colon == std::string::npos || colon+2 >= path.size()) ? "" : path.substr (colon+2) + "/";
+  key += t->GetName();
+  TFile* wfile = TFile::Open (file->GetName());
+  owner.reset (wfile);
+  if (!wfile || wfile->IsZombie()) return nullptr;
+  TTree* wtree = nullptr;
+  wfile->GetObject (key.c_str(), wtree);
+  return wtree;
+}
+
+
+inline std::unique_ptr<TTreeIterator> TTreeIterator::CloneForThread() const {
+  std::unique_ptr<TObject> owner;
+  TTree* tree = OpenTreeHandle (owner);
+  if (!tree) return nullptr;
+  std::unique_ptr<TTreeIterator> clone (new TTreeIterator (tree, verbose()));
+  clone->fOwnedHandle = std::move (owner);
+  clone->SetOverrideBranchAddress (GetOverrideBranchAddress());
+  clone->SetStatsTiming (GetStatsTiming());
+  for (auto& f : fFriends)
+    if (!clone->AddFriend (f.treename.c_str(), f.fname.c_str(), f.alias.c_str(), (f.major.empty() ? nullptr : f.major.c_str()), f.minor.c_str()))
+      return nullptr;
+  clone->fBranches.reserve (std::max (fBranches.size(), size_t(200)));   // as in NewBranchValue, so the addresses don't move
+  for (auto& b : fBranches)
+    (*b.fCloneBranch) (b, *clone);
+  if (verbose() >= 1) Info ("CloneForThread", "cloned %zu branches of tree '%s'", clone->fBranches.size(), GetName());
+  return clone;
+}
+
+
+// Add a copy of branch from to tree (a clone of from's TTreeIterator), with its own default value.
+// We already know the branch's type is OK, so can go straight to SetValueAddress.
+template <typename T>
+inline /*static*/ TTreeIterator::BranchValue* TTreeIterator::BranchValue::CloneBranch (const BranchValue& from, TTreeIterator& tree) {
+  tree.fBranches.emplace_back (tree, from.GetName(), type_default<T>());
+  BranchValue* ibranch = &tree.fBranches.back();
+  ibranch->fIsObj = from.fIsObj;
+  if (!from.fBranch) return ibranch;   // branch wasn't found
+  ibranch->SetBranch (tree.GetTree()->GetBranch (from.GetName()));
+  if (!ibranch->fBranch) {
+    if (tree.verbose() >= 0) tree.Error (tname<T>("CloneForThread"), "branch '%s' not found", from.GetName());
+    return ibranch;
+  }
+  if (!from.fHaveAddr) return ibranch;
+#ifdef USE_TTREE_GETENTRY
+  ibranch->Enable();
+#endif
+  SetValueAddress<T> (ibranch);
+  return ibranch;
+}
+
+
+// Number of worker threads to use for ntasks tasks: 1 if the tree cannot be reopened in another thread.
+inline int TTreeIterator::ParallelThreads (int nthreads, size_t ntasks) const {
+  TTree* t = GetTree();
+  if (!t) return 1;
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (size_t(nthreads) > ntasks) nthreads = ntasks;
+  if (nthreads > 1 && !dynamic_cast<TChain*>(t) && !(t->GetDirectory() && t->GetDirectory()->GetFile())) {
+    if (verbose() >= 0) Warning ("ParallelThreads", "tree '%s' is not in a file, so cannot be shared between threads - run single-threaded", GetName());
+    nthreads = 1;
+  }
+  return nthreads > 1 ? nthreads : 1;
+}
+
+
+// Split ranges into nparts contiguous blocks, [begin,end) indices into ranges, with about the same number of entries in each.
+inline /*static*/ std::vector<std::pair<size_t,size_t>> TTreeIterator::SplitRanges (const std::vector<std::pair<Long64_t,Long64_t>>& ranges, int nparts) {
+  Long64_t total = 0;
+  for (auto& r : ranges) total += r.second - r.first;
+  std::vector<std::pair<size_t,size_t>> blocks;
+  size_t begin = 0;
+  Long64_t sum = 0;
+  for (int ipart = 0; ipart < nparts; ipart++) {
+    size_t end = begin;
+    for (; end < ranges.size(); end++) {   // take ranges whose middle entry is in this part's share
+      Long64_t n = ranges[end].second - ranges[end].first;
+      if (ipart < nparts-1 && (sum + n/2) * nparts >= (ipart+1) * total) break;
+      sum += n;
+    }
+    blocks.emplace_back (begin, end);
+    begin = end;
+  }
+  return blocks;
+}
+
+
+// Run task(iter, iworker, itask, first, last) for each entry range, using nthreads worker threads (see ParallelThreads).
+// Each worker has its own TTreeIterator iter. With a single worker, this TTreeIterator is used in the calling thread.
+// The ranges are dealt out to the workers in contiguous blocks with about the same number of entries, so each
+// worker mostly stays within its own files. A worker that runs out of tasks steals from the end of another
+// worker's block, so small files and slow clusters don't leave threads idle.
+template <typename Task>
+inline Long64_t TTreeIterator::ParallelTasks (int nthreads, const std::vector<std::pair<Long64_t,Long64_t>>& ranges, Task&& task) {
+  using Clock = std::chrono::steady_clock;
+  nthreads = ParallelThreads (nthreads, ranges.size());
+  fWorkerStats.assign (nthreads, WorkerStats());
+  if (nthreads <= 1) {
+    WorkerStats& stats = fWorkerStats[0];
+    auto start = Clock::now();
+    for (size_t itask = 0; itask < ranges.size(); itask++) {
+      task (*this, 0, itask, ranges[itask].first, ranges[itask].second);
+      stats.entries += ranges[itask].second - ranges[itask].first;
+      stats.tasks++;
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now()-start).count();
+    return stats.entries;
+  }
+  if (verbose() >= 1) Info ("ParallelTasks", "process %zu clusters with %d threads", ranges.size(), nthreads);
+
+  struct TaskQueue {
+    std::mutex         lock;
+    std::deque<size_t> tasks;
+  };
+  std::vector<TaskQueue> queues (nthreads);
+  const auto blocks = SplitRanges (ranges, nthreads);
+  for (int i = 0; i < nthreads; i++)
+    for (size_t itask = blocks[i].first; itask < blocks[i].second; itask++)
+      queues[i].tasks.push_back (itask);
+
+  // Next task for iworker: the front of its own queue, or else the back of the next non-empty queue.
+  auto next = [&](int iworker, bool& stolen) -> size_t {
+    for (int i = 0; i < nthreads; i++) {
+      TaskQueue& q = queues[(iworker+i) % nthreads];
+      std::lock_guard<std::mutex> guard (q.lock);
+      if (q.tasks.empty()) continue;
+      size_t itask;
+      if (i == 0) { itask = q.tasks.front(); q.tasks.pop_front(); }
+      else        { itask = q.tasks.back();  q.tasks.pop_back();  }
+      stolen = (i != 0);
+      return itask;
+    }
+    return ranges.size();
+  };
+
+  ROOT::EnableThreadSafety();
+  std::vector<std::exception_ptr> errors (nthreads);
+  std::vector<Stats> iostats (nthreads);
+
+  auto worker = [&](int iworker) {
+    WorkerStats& stats = fWorkerStats[iworker];
+    auto start = Clock::now();
+    try {
+      std::unique_ptr<TTreeIterator> iter = CloneForThread();
+      auto opened = Clock::now();
+      stats.openSeconds = std::chrono::duration<double>(opened-start).count();
+      start = opened;   // so imbalance between threads isn't hidden by differing open times
+      if (!iter) {
+        std::string msg = Form ("thread %d could not open tree '%s'", iworker, GetName());
+        if (verbose() >= 0) Error ("ParallelTasks", "%s", msg.c_str());
+        throw std::runtime_error (msg);
+      }
+      bool stolen = false;
+      for (size_t itask; (itask = next (iworker, stolen)) < ranges.size();) {
+        task (*iter, iworker, itask, ranges[itask].first, ranges[itask].second);
+        stats.entries += ranges[itask].second - ranges[itask].first;
+        stats.tasks++;
+        if (stolen) stats.stolen++;
+      }
+      iostats[iworker] = iter->GetStats();
+    } catch (...) {
+      errors[iworker] = std::current_exception();
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now()-start).count();
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve (nthreads);
+  for (int i = 0; i < nthreads; i++) threads.emplace_back (worker, i);
+  for (auto& thread : threads) thread.join();
+  for (auto& error : errors)
+    if (error) std::rethrow_exception (error);
+  for (auto& s : iostats) fMergedStats += s;   // in thread order
+
+  Long64_t nprocessed = 0;
+  for (size_t i = 0; i < fWorkerStats.size(); i++) {
+    const WorkerStats& stats = fWorkerStats[i];
+    if (verbose() >= 1) Info ("ParallelTasks", "thread %zu: %lld entries in %zu clusters (%zu stolen), %.3f s", i, stats.entries, stats.tasks, stats.stolen, stats.seconds);
+    nprocessed += stats.entries;
+  }
+  return nprocessed;
+}
+
+
+template <typename Fn>
+inline Long64_t TTreeIterator::ParallelForEach (int nthreads, Fn&& fn) {
+  return ParallelTasks (nthreads, ClusterRanges(), [&](TTreeIterator& iter, int, size_t, Long64_t first, Long64_t last) {
+    for (Entry_iterator it (iter, first, last), end (iter, last, last); it != end; ++it)
+      fn (*it);
+  });
+}
+
+
+template <typename Acc, typename Map, typename Combine>
+inline Acc TTreeIterator::ParallelReduce (int nthreads, Acc init, Map&& map, Combine&& combine) {
+  struct Partial { Acc value; };   // avoid std::vector<bool>
+  const auto ranges = ClusterRanges();
+  std::vector<Partial> partials (ranges.size(), Partial{init});
+  ParallelTasks (nthreads, ranges, [&](TTreeIterator& iter, int, size_t itask, Long64_t first, Long64_t last) {
+    Acc& acc = partials[itask].value;
+    for (Entry_iterator it (iter, first, last), end (iter, last, last); it != end; ++it)
+      map (acc, *it);
+  });
+  for (auto& partial : partials)   // in entry order, so the result doesn't depend on the thread scheduling
+    combine (init, partial.value);
+  return init;
+}
+
+
+template <typename FillFn, typename... Hists>
+inline Long64_t TTreeIterator::ParallelFill (int nthreads, FillFn&& fill, Hists&... hists) {
+  return ParallelFillImpl (nthreads, std::forward<FillFn>(fill), make_index_sequence<sizeof...(Hists)>(), hists...);
+}
+
+
+template <typename FillFn, std::size_t... I, typename... Hists>
+inline Long64_t TTreeIterator::ParallelFillImpl (int nthreads, FillFn&& fill, index_sequence<I...>, Hists&... hists) {
+  const auto ranges = ClusterRanges();
+  nthreads = ParallelThreads (nthreads, ranges.size());
+  std::vector<std::tuple<std::unique_ptr<Hists>...>> clones;   // each worker's own empty copy of the histograms
+  clones.reserve (nthreads);
+  for (int i = 0; i < nthreads; i++)
+    clones.emplace_back (std::unique_ptr<Hists>(EmptyClone(hists))...);
+  Long64_t nentries = ParallelTasks (nthreads, ranges, [&](TTreeIterator& iter, int iworker, size_t, Long64_t first, Long64_t last) {
+    auto& h = clones[iworker];
+    for (Entry_iterator it (iter, first, last), end (iter, last, last); it != end; ++it)
+      fill (*it, *std::get<I>(h)...);
+  });
+  for (auto& h : clones) {   // in worker order
+    int expand[] = {0, (hists.Add (std::get<I>(h).get()), 0)...};
+    (void)expand;
+  }
+  return nentries;
+}
+
+
+template <typename Fn>
+inline Long64_t TTreeIterator::ParallelFillEntries (int nthreads, Long64_t nfill, Fn&& fn) {
+  return ParallelFillEntries (nthreads, nfill, Schema(), std::forward<Fn>(fn));
+}
+
+
+template <typename Fn>
+inline Long64_t TTreeIterator::ParallelFillEntries (int nthreads, Long64_t nfill, const Schema& schema, Fn&& fn) {
+  TTree* t = GetTree();
+  if (!t || nfill <= 0) return 0;
+  const Long64_t nentries = t->GetEntries();
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads > nfill) nthreads = nfill;
+  if (nthreads <= 1) {
+    for (auto& entry : (schema.empty() ? FillEntries (nfill) : FillEntries (nfill, schema)))
+      fn (entry, entry.index() - nentries);
+    return GetTree()->GetEntries() - nentries;
+  }
+  if (verbose() >= 1) Info ("ParallelFillEntries", "fill %lld entries with %d threads", nfill, nthreads);
+
+  ROOT::EnableThreadSafety();
+  TDirectory* dir = t->GetDirectory();
+  const int compress = (dir && dir->GetFile()) ? dir->GetFile()->GetCompressionSettings() : -1;
+  std::string tmpname = Form ("%s/TTreeIterator_%d_%p_", gSystem->TempDirectory(), gSystem->GetPid(), (void*)this);
+  std::vector<std::string> names;
+  for (int i = 0; i < nthreads; i++) names.push_back (tmpname + std::to_string(i) + ".root");
+  std::vector<std::exception_ptr> errors (nthreads);
+  std::vector<Stats> iostats (nthreads);
+
+  auto worker = [&](int iworker) {
+    try {
+      Long64_t first = nfill *  iworker    / nthreads;
+      Long64_t last  = nfill * (iworker+1) / nthreads;
+      TFile file (names[iworker].c_str(), "recreate");
+      if (file.IsZombie()) {
+        std::string msg = Form ("thread %d could not create file %s", iworker, names[iworker].c_str());
+        if (verbose() >= 0) Error ("ParallelFillEntries", "%s", msg.c_str());
+        throw std::runtime_error (msg);
+      }
+      if (compress >= 0) file.SetCompressionSettings (compress);   // the baskets will be copied as they are
+      TTreeIterator iter (GetName(), &file, verbose());
+      iter.fBufsize            = fBufsize;
+      iter.fSplitlevel         = fSplitlevel;
+      iter.fAutoFlush          = fAutoFlush;
+      iter.fOptimizeBaskets    = fOptimizeBaskets;
+      iter.fCompression        = fCompression;
+      iter.fCheckpointEntries  = fCheckpointEntries;   // bounds each thread's basket memory
+      iter.fCheckpointBytes    = fCheckpointBytes;
+      iter.fCheckpointSeconds  = fCheckpointSeconds;
+      iter.fCheckpointAutoSave = fCheckpointAutoSave;
+      for (auto& entry : (schema.empty() ? iter.FillEntries (last-first) : iter.FillEntries (last-first, schema)))
+        fn (entry, first + entry.index());   // Fill_iterator writes the tree at the end
+      iostats[iworker] = iter.GetStats();
+    } catch (...) {
+      errors[iworker] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve (nthreads);
+  for (int i = 0; i < nthreads; i++) threads.emplace_back (worker, i);
+  for (auto& thread : threads) thread.join();
+
+  for (int i = 0; i < nthreads; i++) {
+    if (!errors[i]) {
+      TFile file (names[i].c_str());
+      TTree* in = nullptr;
+      if (!file.IsZombie()) file.GetObject (GetName(), in);
+      if (!in) {
+        std::string msg = Form ("no tree '%s' from thread %d", GetName(), i);
+        if (verbose() >= 0) Error ("ParallelFillEntries", "%s", msg.c_str());
+        errors[i] = std::make_exception_ptr (std::runtime_error (msg));
+      } else {
+        if (GetTree()->GetNbranches() == 0) {   // new tree: use the first thread's branches
+          TTree* out = in->CloneTree (0);
+          out->ResetBranchAddresses();
+          out->SetDirectory (dir);
+          if (fTreeOwned || dir) delete fTree;
+          fTree = out;
+          fTreeOwned = !dir;
+        }
+        std::string diff = BranchLayoutDiff (GetTree(), in);
+        if (!diff.empty()) {   // "fast" copies baskets as they are, so the branches must match exactly
+          std::string msg = Form ("thread %d filled different branches: %s", i, diff.c_str());
+          if (verbose() >= 0) Error ("ParallelFillEntries", "%s", msg.c_str());
+          errors[i] = std::make_exception_ptr (std::runtime_error (msg));
+        } else {
+          Long64_t ncopy = GetTree()->CopyEntries (in, -1, "fast");
+          if (verbose() >= 1) Info ("ParallelFillEntries", "copied %lld entries from thread %d", ncopy, i);
+        }
+      }
+    }
+    gSystem->Unlink (names[i].c_str());
+  }
+  for (auto& s : iostats) fMergedStats += s;
+  for (auto& error : errors)
+    if (error) std::rethrow_exception (error);
+  Write();
+  return GetTree()->GetEntries() - nentries;
+}
+
+
+// Describe the first difference in the top-level branches of two trees (name, type, or leaflist), or "" if they match
+inline /*static*/ std::string TTreeIterator::BranchLayoutDiff (TTree* a, TTree* b) {
+  TObjArray* la = a->GetListOfBranches();
+  TObjArray* lb = b->GetListOfBranches();
+  const Int_t na = la->GetEntriesFast(), nb = lb->GetEntriesFast();
+  for (Int_t i = 0; i < na || i < nb; i++) {
+    if (i >= na) return Form ("extra branch '%s'", lb->UncheckedAt(i)->GetName());
+    if (i >= nb) return Form ("missing branch '%s'", la->UncheckedAt(i)->GetName());
+    TBranch* ba = static_cast<TBranch*>(la->UncheckedAt(i));
+    TBranch* bb = static_cast<TBranch*>(lb->UncheckedAt(i));
+    if (strcmp (ba->GetName(), bb->GetName()) != 0)
+      return Form ("branch %d is '%s', not '%s'", i, bb->GetName(), ba->GetName());
+    if (strcmp (BranchTypeName(ba), BranchTypeName(bb)) != 0 || strcmp (ba->GetTitle(), bb->GetTitle()) != 0)
+      return Form ("branch '%s' has type %s (%s), not %s (%s)", ba->GetName(), BranchTypeName(bb), bb->GetTitle(), BranchTypeName(ba), ba->GetTitle());
+  }
+  return "";
+}
+
+
+// Empty copy of a histogram, not attached to any directory
+template <typename H>
+inline /*static*/ H* TTreeIterator::EmptyClone (const H& hist) {
+  H* h = static_cast<H*>(hist.Clone());
+  h->SetDirectory (nullptr);
+  h->Reset();
+  return h;
+}
+
+#endif /* ROOT_TTreeIterator_parallel */
@@ -1,7 +1,11 @@
+// Benchmarks of std::any and Cpp11::any operations (construct, copy, move, emplace, assign, cast) for
+// small, medium, and large value types.
+// The Cpp11::any option macros (see TTreeIterator/detail/Cpp11_any.h) can be set on the command line, with
+// ANY_BENCH_VARIANT naming the combination: CMake builds a BenchAny_<variant> target for each one.
+
 #define USE_std_any 1
 #define USE_Cpp11_any 1
 #define MYBENCH 1
-//#define TEST_SAME_TYPE 1
 
 #if defined(USE_std_any) && (__cplusplus < 201703L)   // <version> not available until GCC9, so no way to check __cpp_lib_any without including <any>.
 # undef USE_std_any                  // only option is to use Cpp11::any
@@ -11,13 +15,23 @@
 # include <any>
 #else
 
+// keep any command-line options for Cpp11::any below
+#pragma push_macro("ANY_TEMPLATE_OPT")
+#pragma push_macro("NO_ANY_RTTI_CHECK")
+#pragma push_macro("NO_ANY_RTTI")
+#pragma push_macro("NO_ANY_ACCESS")
+#pragma push_macro("UNCHECKED_ANY")
+#pragma push_macro("NO_ANY_EXCEPTIONS")
+#pragma push_macro("ANY_SAME_TYPE")
+#undef ANY_TEMPLATE_OPT
+#undef NO_ANY_RTTI_CHECK
+#undef NO_ANY_RTTI
+#undef NO_ANY_ACCESS
+#undef UNCHECKED_ANY
+#undef NO_ANY_EXCEPTIONS
+#undef ANY_SAME_TYPE
+
 #define ANY_TEMPLATE_OPT 1   // optimise templated any methods
-//#define NO_ANY_RTTI_CHECK 1  // don't check type_info in any_cast<T>(any), just use templated function pointer - not useful optimisation
-//#define NO_ANY_RTTI 1        // don't use type_info (removes any::type() method) - not standard conforming
-//#define NO_ANY_ACCESS 1      // don't include any::Manager<T>::manage(Op_access) method - not ABI compatible with std::any
-//#define UNCHECKED_ANY 1      // don't check type of any_cast<T>(any)             - not standard conforming
-//#define NO_ANY_EXCEPTIONS 1  // don't throw exceptions                           - not standard conforming
-//#define ANY_SAME_TYPE 1      // when assigning the same as existing type, don't recreate
 
 #define Cpp11_std_any 1
 #include "TTreeIterator/detail/Cpp11_any.h"  // Implementation of std::any, compatible with C++11.
@@ -25,18 +39,20 @@
 #undef Cpp11_std_any
 #undef HEADER_Cpp11_any
 #undef ANY_TEMPLATE_OPT
-#undef NO_ANY_RTTI_CHECK
-#undef NO_ANY_RTTI
-#undef NO_ANY_ACCESS
-#undef UNCHECKED_ANY
-#undef NO_ANY_EXCEPTIONS
-#undef ANY_SAME_TYPE
+#pragma pop_macro("ANY_TEMPLATE_OPT")
+#pragma pop_macro("NO_ANY_RTTI_CHECK")
+#pragma pop_macro("NO_ANY_RTTI")
+#pragma pop_macro("NO_ANY_ACCESS")
+#pragma pop_macro("UNCHECKED_ANY")
+#pragma pop_macro("NO_ANY_EXCEPTIONS")
+#pragma pop_macro("ANY_SAME_TYPE")
 
 #endif
 
 
 #ifdef USE_Cpp11_any
 
+#ifndef ANY_BENCH_VARIANT     // otherwise options are taken from the command line
 #define ANY_TEMPLATE_OPT 1   // optimise templated any methods
 //#define NO_ANY_RTTI_CHECK 1  // don't check type_info in any_cast<T>(any), just use templated function pointer - not useful optimisation
 #define NO_ANY_RTTI 1        // don't use type_info (removes any::type() method) - not standard conforming
@@ -44,6 +60,8 @@
 #define UNCHECKED_ANY 1      // don't check type of any_cast<T>(any)             - not standard conforming
 #define NO_ANY_EXCEPTIONS 1  // don't throw exceptions                           - not standard conforming
 #define ANY_SAME_TYPE 1      // when assigning the same as existing type, don't recreate
+#define ANY_BENCH_VARIANT optimised
+#endif
 
 #include "TTreeIterator/detail/Cpp11_any.h"  // Implementation of std::any, compatible with C++11.
 #endif
@@ -71,49 +89,142 @@ Any get_any(size_t i=2) {
 #ifdef MYBENCH
 
 #include <benchmark/benchmark.h>
-using namespace std::string_literals;
 
-static void BM_std_any(benchmark::State& state) {
-#ifdef TEST_SAME_TYPE
-  auto a = get_any<any_type1>(1);
-  const std::string s("abc");
+// Small values are stored inside any; medium values fit in basic_any<32>; large ones are always on the heap.
+template<size_t N> struct Payload { double x[N/sizeof(double)]; };
+using Small  = double;
+using Medium = Payload<24>;
+using Large  = Payload<256>;
+
+template<typename T> T make_value() { T v; for (size_t i=0; i<sizeof(v.x)/sizeof(v.x[0]); i++) v.x[i] = 1.7*i; return v; }
+template<> double make_value<double>() { return 1.7; }
+
+template<typename T> const T& any_get(const any_type1& a) { return any_ns1::any_cast<const T&>(a); }
+#ifdef USE_Cpp11_any
+template<typename T> const T& any_get(const any_type2& a) { return any_ns2::any_cast<const T&>(a); }
+#define ANY_BENCH_STR1(x) #x
+#define ANY_BENCH_STR(x) ANY_BENCH_STR1(x)
+template<typename Any> const char* any_label() { return std::is_same<Any,any_type1>::value ? "std::any" : "Cpp11::any " ANY_BENCH_STR(ANY_BENCH_VARIANT); }
+#else
+template<typename Any> const char* any_label() { return "std::any"; }
+#endif
+
+template<typename Any, typename T>
+static void BM_construct(benchmark::State& state) {
+  const T v = make_value<T>();
   for (auto _ : state) {
-    a = 3.1;
-    //    a.emplace<std::string>({'a','x'});
-    benchmark::DoNotOptimize(a);
-    a = s;
+    Any a(v);
     benchmark::DoNotOptimize(a);
   }
-#else
-  const auto a = get_any<any_type1>();
+  state.SetLabel (any_label<Any>());
+}
+
+template<typename Any, typename T>
+static void BM_copy(benchmark::State& state) {
+  const Any a = make_value<T>();
   for (auto _ : state) {
-    auto d = any_ns1::any_cast<double>(a);
-    benchmark::DoNotOptimize(d);
+    Any b(a);
+    benchmark::DoNotOptimize(b);
   }
-#endif
+  state.SetLabel (any_label<Any>());
 }
-BENCHMARK(BM_std_any);
 
-static void BM_Cpp11_any(benchmark::State& state) {
-#ifdef TEST_SAME_TYPE
-  auto a = get_any<any_type2>(1);
-  const std::string s("abc");
+template<typename Any, typename T>
+static void BM_move(benchmark::State& state) {
+  Any a = make_value<T>();
   for (auto _ : state) {
-    a = 3.1;
-    //    a.emplace<std::string>({'a','x'});
+    Any b(std::move(a));
+    benchmark::DoNotOptimize(b);
+    a = std::move(b);
+  }
+  state.SetLabel (any_label<Any>());
+}
+
+template<typename Any, typename T>
+static void BM_emplace(benchmark::State& state) {
+  const T v = make_value<T>();
+  Any a = v;
+  for (auto _ : state) {
+    a.template emplace<T>(v);
     benchmark::DoNotOptimize(a);
-    a = s;
+  }
+  state.SetLabel (any_label<Any>());
+}
+
+// assign the same type as already held (optimised by ANY_SAME_TYPE)
+template<typename Any, typename T>
+static void BM_assign_same(benchmark::State& state) {
+  const T v = make_value<T>();
+  Any a = v;
+  for (auto _ : state) {
+    a = v;
     benchmark::DoNotOptimize(a);
   }
-#else
-  const auto a = get_any<any_type2>();
+  state.SetLabel (any_label<Any>());
+}
+
+template<typename Any, typename T>
+static void BM_cast(benchmark::State& state) {
+  Any a = make_value<T>();
+  benchmark::DoNotOptimize(a);  // make sure optimiser doesn't know what type it is
   for (auto _ : state) {
-    auto d = any_ns2::any_cast<double>(a);
-    benchmark::DoNotOptimize(d);
+    const T& v = any_get<T>(a);
+    benchmark::DoNotOptimize(v);
   }
+  state.SetLabel (any_label<Any>());
+}
+
+#define BENCH_ANY_OP(op, Any) \
+  BENCHMARK_TEMPLATE(op, Any, Small); \
+  BENCHMARK_TEMPLATE(op, Any, Medium); \
+  BENCHMARK_TEMPLATE(op, Any, Large)
+#define BENCH_ANY_ALL(Any) \
+  BENCH_ANY_OP(BM_construct,   Any); \
+  BENCH_ANY_OP(BM_copy,        Any); \
+  BENCH_ANY_OP(BM_move,        Any); \
+  BENCH_ANY_OP(BM_emplace,     Any); \
+  BENCH_ANY_OP(BM_assign_same, Any); \
+  BENCH_ANY_OP(BM_cast,        Any)
+BENCH_ANY_ALL(any_type1);
+#ifdef USE_Cpp11_any
+BENCH_ANY_ALL(any_type2);
 #endif
+
+#ifdef USE_Cpp11_any
+// Compare values stored on the heap (Cpp11::any) with those stored in a larger inline buffer (Cpp11::basic_any<N>)
+
+template<typename Any, size_t N>
+static void BM_any_access(benchmark::State& state) {
+  Payload<N> p{};
+  const Any a = p;
+  for (auto _ : state) {
+    auto& v = Cpp11::any_cast<const Payload<N>&>(a);
+    benchmark::DoNotOptimize(v.x[0]);
+  }
+  state.SetLabel (Any::template is_inline<Payload<N>>() ? "inline" : "heap");
 }
-BENCHMARK(BM_Cpp11_any);
+
+template<typename Any, size_t N>
+static void BM_any_emplace(benchmark::State& state) {
+  Payload<N> p{};
+  Any a;
+  for (auto _ : state) {
+    a.template emplace<Payload<N>>(p);
+    benchmark::DoNotOptimize(a);
+  }
+  state.SetLabel (Any::template is_inline<Payload<N>>() ? "inline" : "heap");
+}
+
+#define BENCH_ANY_SIZE(N) \
+  BENCHMARK_TEMPLATE(BM_any_access,  Cpp11::any,                N); \
+  BENCHMARK_TEMPLATE(BM_any_access,  Cpp11::basic_any<N>,       N); \
+  BENCHMARK_TEMPLATE(BM_any_emplace, Cpp11::any,                N); \
+  BENCHMARK_TEMPLATE(BM_any_emplace, Cpp11::basic_any<N>,       N)
+BENCH_ANY_SIZE(8);
+BENCH_ANY_SIZE(16);
+BENCH_ANY_SIZE(32);
+BENCH_ANY_SIZE(64);
+#endif
 
 BENCHMARK_MAIN();
 
@@ -0,0 +1,143 @@
+// Compare write and read throughput, and file size, for different TTreeIterator compression policies
+// on the three timingTests tree shapes.
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <benchmark/benchmark.h>
+
+#include "TFile.h"
+#include "TSystem.h"
+#include "TError.h"
+
+#include "TTreeIterator/TTreeIterator.h"
+
+#ifndef NFILL
+#define NFILL 100000
+#endif
+#ifndef NX
+#define NX 100
+#endif
+
+const Long64_t nfill = NFILL;
+constexpr size_t nx = NX;
+const double vinit = 42.3;
+const char* const fname = "test_compress.root";
+
+// A simple user-defined POD class
+struct MyStruct {
+  double x[nx];
+};
+template<> const char* TTreeIterator::GetLeaflist<MyStruct>() { return Form("x[%d]/D",int(nx)); }
+
+using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+
+struct Policy {
+  const char* name;
+  std::vector<std::pair<const char*,int>> settings;  // (pattern, compression settings)
+};
+
+// hot (first 10 double branches, or the whole object for shapes 2 and 3) use LZ4, the rest LZMA
+const std::vector<Policy> policies = {
+  {"uncompressed", {{"*", 0}}},
+  {"ZLIB-1",       {{"*", ROOT::CompressionSettings (Algorithm::kZLIB, 1)}}},
+  {"LZ4-4",        {{"*", ROOT::CompressionSettings (Algorithm::kLZ4,  4)}}},
+  {"ZSTD-5",       {{"*", ROOT::CompressionSettings (Algorithm::kZSTD, 5)}}},
+  {"LZMA-8",       {{"*", ROOT::CompressionSettings (Algorithm::kLZMA, 8)}}},
+  {"hot LZ4, cold LZMA", {{"*",     ROOT::CompressionSettings (Algorithm::kLZMA, 8)},
+                          {"x00?",  ROOT::CompressionSettings (Algorithm::kLZ4,  4)},
+                          {"M",     ROOT::CompressionSettings (Algorithm::kLZ4,  4)},
+                          {"vx",    ROOT::CompressionSettings (Algorithm::kLZ4,  4)}}},
+};
+
+const char* const shapes[] = {"doubles", "MyStruct", "vector<double>"};
+
+using Clock = std::chrono::steady_clock;
+
+// Fill one of the timingTests tree shapes, returning the uncompressed bytes filled
+Long64_t Fill (int shape, const Policy& policy) {
+  TFile file (fname, "recreate");
+  TTreeIterator iter ("test", &file);
+  for (auto& c : policy.settings) iter.SetCompressionSettings (c.first, c.second);
+  double v = vinit;
+  if (shape == 0) {
+    std::vector<std::string> bnames;
+    for (size_t i=0; i<nx; i++) bnames.emplace_back (Form("x%03zu",i));
+    for (auto& entry : iter.FillEntries(nfill)) {
+      for (auto& b : bnames) entry[b.c_str()] = v++;
+      entry.Fill();
+    }
+  } else if (shape == 1) {
+    MyStruct M;
+    for (auto& entry : iter.FillEntries(nfill)) {
+      for (auto& x : M.x) x = v++;
+      entry["M"] = M;
+      entry.Fill();
+    }
+  } else {
+    for (auto& entry : iter.FillEntries(nfill)) {
+      auto& vx = entry.Modify<std::vector<double>>("vx");
+      vx.clear();
+      for (size_t i=0; i<nx; i++) vx.push_back(v++);
+      entry.Fill();
+    }
+  }
+  return iter->GetTotBytes();   // tree is written by the Fill_iterator at the end of the loop
+}
+
+double Get (int shape) {
+  TFile file (fname);
+  TTreeIterator iter ("test", &file);
+  double vsum = 0.0;
+  if (shape == 0) {
+    std::vector<std::string> bnames;
+    for (size_t i=0; i<nx; i++) bnames.emplace_back (Form("x%03zu",i));
+    for (auto& entry : iter)
+      for (auto& b : bnames) vsum += entry.Get<double>(b.c_str());
+  } else if (shape == 1) {
+    for (auto& entry : iter) {
+      const MyStruct& M = entry["M"];
+      for (auto& x : M.x) vsum += x;
+    }
+  } else {
+    for (auto& entry : iter) {
+      const std::vector<double>& vx = entry["vx"];
+      for (auto& x : vx) vsum += x;
+    }
+  }
+  return vsum;
+}
+
+static void BM_Compress (benchmark::State& state) {
+  int shape = state.range(0);
+  const Policy& policy = policies[state.range(1)];
+  double wtime = 0.0, rtime = 0.0, mbytes = 0.0, fsize = 0.0;
+  for (auto _ : state) {
+    auto t0 = Clock::now();
+    Long64_t nbytes = Fill (shape, policy);
+    auto t1 = Clock::now();
+    double vsum = Get (shape);
+    auto t2 = Clock::now();
+    benchmark::DoNotOptimize(vsum);
+    wtime += std::chrono::duration<double>(t1-t0).count();
+    rtime += std::chrono::duration<double>(t2-t1).count();
+    mbytes += 1e-6 * double(nbytes);
+    FileStat_t st;
+    if (gSystem->GetPathInfo (fname, st) == 0) fsize = 1e-6 * double(st.fSize);
+  }
+  state.counters["write_MB/s"] = mbytes / wtime;
+  state.counters["read_MB/s"]  = mbytes / rtime;
+  state.counters["file_MB"]    = fsize;
+  state.SetLabel (Form("%s, %s", shapes[shape], policy.name));
+  gSystem->Unlink (fname);
+}
+
+static void CompressArgs (benchmark::internal::Benchmark* b) {
+  for (int shape = 0; shape < 3; ++shape)
+    for (int ipolicy = 0; ipolicy < int(policies.size()); ++ipolicy)
+      b->Args ({shape, ipolicy});
+}
+BENCHMARK(BM_Compress)->Apply(CompressArgs)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,119 @@
+// Compare TTreeIterator::BuildIndex/Find with TTreeIndex (TTree::BuildIndex and GetEntryNumberWithIndex), looking up
+// entries by (run,event) in random order.
+// Find's index holds about 16 bytes per entry, where TTreeIndex holds 24 (the combined and minor key values, and the
+// entry number). A Find lookup is one hash probe, usually a single cache miss, confirmed by the slot's fingerprint
+// without reading the tree, while TTreeIndex does a binary search over all the entries. With read=1 each entry found
+// is also read, which costs the same for both. Building the index reads just the key branches in both cases.
+
+#include <string>
+#include <vector>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "TFile.h"
+#include "TSystem.h"
+#include "TError.h"
+
+#include "TTreeIterator/TTreeIterator.h"
+
+#ifndef NINDEX
+#define NINDEX 1000000
+#endif
+#ifndef NPERRUN
+#define NPERRUN 1000
+#endif
+#ifndef NLOOKUP
+#define NLOOKUP 10000
+#endif
+
+const Long64_t nindex = NINDEX;
+const double vinit = 42.3;
+const char* const fname = "test_index.root";
+
+Int_t RunNumber   (Long64_t i) { return 1000 + Int_t(i / NPERRUN); }
+Int_t EventNumber (Long64_t i) { return 1 + 7 * Int_t(i % NPERRUN); }   // not contiguous
+
+// Write the file once per benchmark run
+struct IndexFile {
+  std::vector<std::pair<Int_t,Int_t>> keys;   // (run,event) to look up, in random order
+  IndexFile() {
+    {
+      TFile file (fname, "recreate");
+      TTreeIterator iter ("test", &file);
+      for (auto& entry : iter.FillEntries (nindex)) {
+        Long64_t i = entry.index();
+        entry["run"]   = RunNumber(i);
+        entry["event"] = EventNumber(i);
+        entry["x"]     = vinit + i;
+        entry.Fill();
+      }
+    }
+    std::mt19937_64 rng (12345);
+    std::uniform_int_distribution<Long64_t> pick (0, nindex-1);
+    for (int i = 0; i < NLOOKUP; i++) {
+      Long64_t ientry = pick (rng);
+      keys.emplace_back (RunNumber(ientry), EventNumber(ientry));
+    }
+  }
+  ~IndexFile() {
+    gSystem->Unlink (fname);
+  }
+  static IndexFile& Get() { static IndexFile files; return files; }
+};
+
+// Load entry ientry, as Find does
+double ReadX (TTreeIterator& iter, Long64_t ientry) {
+  TTreeIterator::Entry entry (iter, ientry);
+#ifdef USE_TTREE_GETENTRY
+  entry.GetEntry();
+#else
+  entry.LoadTree (ientry);
+#endif
+  return entry["x"];
+}
+
+// Arg: 0 = TTreeIterator::BuildIndex, 1 = TTree::BuildIndex
+static void BM_IndexBuild (benchmark::State& state) {
+  IndexFile::Get();
+  const bool ttreeindex = state.range(0);
+  for (auto _ : state) {
+    TFile file (fname);
+    TTreeIterator iter ("test", &file);
+    bool ok = ttreeindex ? iter.GetTree()->BuildIndex ("run", "event") > 0
+                         : iter.BuildIndex ({"run", "event"});
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed (state.iterations() * nindex);
+  state.SetLabel (ttreeindex ? "TTreeIndex" : "TTreeIterator");
+}
+BENCHMARK(BM_IndexBuild)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Args: (0 = TTreeIterator::Find, 1 = TTreeIndex), (0 = lookup only, 1 = also read x)
+static void BM_IndexFind (benchmark::State& state) {
+  IndexFile& files = IndexFile::Get();
+  const bool ttreeindex = state.range(0), read = state.range(1);
+  TFile file (fname);
+  TTreeIterator iter ("test", &file);
+  if (ttreeindex) iter.GetTree()->BuildIndex ("run", "event");
+  else            iter.BuildIndex ({"run", "event"});
+  Long64_t nfound = 0;
+  for (auto _ : state) {
+    double xsum = 0.0;
+    for (auto& k : files.keys) {
+      Long64_t ientry = ttreeindex ? iter.GetTree()->GetEntryNumberWithIndex (k.first, k.second)
+                                   : iter.FindEntry ({k.first, k.second});
+      if (ientry < 0) continue;
+      nfound++;
+      if (read) xsum += ReadX (iter, ientry);
+    }
+    benchmark::DoNotOptimize(xsum);
+  }
+  if (nfound != Long64_t(state.iterations() * files.keys.size()))
+    state.SkipWithError ("some keys were not found");
+  state.SetItemsProcessed (state.iterations() * files.keys.size());
+  state.SetLabel (Form ("%s%s", (ttreeindex ? "TTreeIndex" : "TTreeIterator"), (read ? " + read" : "")));
+}
+BENCHMARK(BM_IndexFind)->Args({0,0})->Args({1,0})->Args({0,1})->Args({1,1})->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -5,8 +5,13 @@
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include <cmath>
 #include <iostream>
+#include <sstream>
+#include <fstream>
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -201,6 +206,459 @@ TEST(iterTests1, AlgIter) {
   std::cout << '\n';
 }
 
+TEST(iterTests1, DefaultValue) {
+  TFile f ("iterTests1.root");
+  if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+
+  {
+    TTreeIterator iter ("test", &f, -1);   // don't report missing branch
+    for (auto& entry : iter) {
+      double& d = entry.Get<double>("nobranch");
+      EXPECT_TRUE (std::isnan (d));
+      d = 1.0;   // only changes this TTreeIterator's default
+      EXPECT_EQ (entry.Get<double>("nobranch"), 1.0);
+      break;
+    }
+  }
+  TTreeIterator iter ("test", &f, -1);
+  for (auto& entry : iter) {
+    EXPECT_TRUE (std::isnan (entry.Get<double>("nobranch")));
+    EXPECT_TRUE (std::isnan (entry.Value<double>("nobranch")));
+    EXPECT_EQ (entry.Value<double>("x"), entry.Get<double>("x"));
+  }
+}
+
+TEST(iterTests1, StatsIter) {
+  TFile f ("iterTests1.root");
+  if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+  TTreeIterator iter ("test", &f, verbose);
+  iter.SetStatsTiming (true);
+  for (auto& entry : iter) {
+    double x = entry["x"];
+    const std::string& s = entry["s"];
+    (void)x; (void)s;
+  }
+  auto stats = iter.GetStats();
+#ifndef NO_BranchValue_STATS
+  EXPECT_EQ (stats.entries, nfill1);
+  EXPECT_EQ (stats.branches.size(), 2);
+#ifndef USE_TTREE_GETENTRY
+  EXPECT_EQ (stats.branches["x"].calls, nfill1);
+  EXPECT_GT (stats.branches["x"].bytes, 0);
+  EXPECT_GE (stats.branches["x"].baskets, 1);
+#endif
+  EXPECT_EQ (stats.total.calls, stats.branches["x"].calls + stats.branches["s"].calls);
+  EXPECT_EQ (stats.total.hits + stats.total.misses, 2*(nfill1-1));   // first lookups create the BranchValues
+  EXPECT_GE (stats.loopSeconds, 0.0);
+#endif
+
+  auto sum = stats;
+  sum += stats;
+  EXPECT_EQ (sum.branches["s"].calls, 2*stats.branches["s"].calls);
+  EXPECT_EQ (sum.entries, 2*stats.entries);
+
+  std::ostringstream csv, io, json;
+  iter.WriteStats (csv, false, true);
+  iter.WriteIOStats (io, true);
+  iter.WriteStats (json, true);
+  const std::string rows = csv.str(), iorows = io.str();
+  EXPECT_EQ (std::count (rows.begin(), rows.end(), '\n'), 2);   // header, total
+  EXPECT_EQ (rows.compare (0, rows.find('\n'), "time/C,host/C,label/C,testcase/C,test/C,fill/B,entries/L,branches/I,elements/l,ms/D,cpu/D"), 0);
+  EXPECT_EQ (std::count (iorows.begin(), iorows.end(), '\n'), 2 + long(stats.branches.size()));   // header, total, each branch
+  EXPECT_NE (iorows.find (",\"x\","), std::string::npos);
+  EXPECT_EQ (json.str().front(), '{');
+
+  iter.ResetStats();
+  stats = iter.GetStats();
+  EXPECT_EQ (stats.entries, 0);
+  EXPECT_EQ (stats.total.bytes, 0);
+  EXPECT_TRUE (stats.branches.empty());
+}
+
+TEST(iterTests1, CheckpointIter) {
+  const Long64_t nfill = 10, every = 4;
+  double sum = 0.0;
+  {
+    TFile f ("iterTests1_checkpoint.root", "recreate");
+    if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+    TTreeIterator iter ("test", &f, verbose);
+    iter.SetCheckpoint (every);
+    for (auto& entry : iter.FillEntries(nfill)) {
+      entry["x"] = double(entry.index());
+      sum += entry.index();
+      entry.Fill();
+    }
+    auto stats = iter.GetStats();
+    EXPECT_EQ (stats.checkpoints, size_t(nfill/every));
+    EXPECT_GT (stats.checkpointBytes, 0);
+    EXPECT_GE (stats.checkpointSeconds, stats.maxCheckpointSeconds);
+    std::ostringstream json;
+    iter.WriteStats (json, true);
+    EXPECT_NE (json.str().find (Form("\"checkpoints\":%lld", nfill/every)), std::string::npos);
+    iter.ResetStats();
+    EXPECT_EQ (iter.GetStats().checkpoints, 0);
+  }
+  TFile f ("iterTests1_checkpoint.root");
+  if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+  TTreeIterator iter ("test", &f, verbose);
+  EXPECT_EQ (iter.GetEntries(), nfill);
+  double rsum = 0.0;
+  for (auto& entry : iter) rsum += entry.Get<double>("x");
+  EXPECT_EQ (rsum, sum);
+}
+
+TEST(iterTests1, SchemaFill) {
+  const char* fname = "iterTests1_schema.root";
+  const Long64_t nfill = 10;
+  {
+    TFile f (fname, "recreate");
+    if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+    TTreeIterator iter ("test", &f, verbose);
+    TTreeIterator::Schema schema {{"x", TTreeIterator::type<double>()},
+                                  {"i", TTreeIterator::type<int>()},
+                                  {"v", TTreeIterator::type<std::vector<double>>()}};
+    for (auto& entry : iter.FillEntries (nfill, schema)) {   // SetAt(i) sets schema branch i
+      Long64_t i = entry.index();
+      entry.SetAt (0, vinit + i);
+      entry.SetAt (1, int(i));
+      entry.SetAt (2, std::vector<double> (i, vinit));
+      entry.Fill();
+    }
+#ifndef NO_BranchValue_STATS
+    auto stats = iter.GetStats();
+    EXPECT_EQ (stats.total.hits + stats.total.misses, 0);   // no lookups by name
+#endif
+    TTreeIterator::Schema other {{"i", TTreeIterator::type<int>()}};
+    Long64_t n = 0;
+    for (auto& entry : iter.FillEntries (1, other)) {   // refused: "i" isn't our first branch
+      entry.Fill();
+      n++;
+    }
+    EXPECT_EQ (n, 0);
+  }
+  TFile f (fname);
+  TTreeIterator iter ("test", &f, verbose);
+  EXPECT_EQ (iter.GetEntries(), nfill);
+  for (auto& entry : iter) {
+    Long64_t i = entry.index();
+    EXPECT_EQ (entry.Get<double>("x"), vinit + i);
+    EXPECT_EQ (entry.Get<int>("i"), int(i));
+    const auto& v = entry.Get<std::vector<double>>("v");
+    EXPECT_EQ (v.size(), size_t(i));
+    if (!v.empty()) EXPECT_EQ (v.back(), vinit);
+  }
+  gSystem->Unlink (fname);
+}
+
+TEST(iterTests1, ModifyFill) {
+  const char* fname = "iterTests1_modify.root";
+  const Long64_t nfill = 8;
+  auto vsize = [](Long64_t i) { return size_t((i*3) % 5); };   // includes empty vectors, and shrinking
+  {
+    TFile f (fname, "recreate");
+    if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+    TTreeIterator iter ("test", &f, verbose);
+    size_t maxsize = 0;
+    for (auto& entry : iter.FillEntries (nfill)) {
+      Long64_t i = entry.index();
+      auto& v = entry.Modify<std::vector<double>>("v");
+      EXPECT_GE (v.capacity(), maxsize);   // kept from the previous entry
+      v.clear();
+      for (size_t j = 0; j < vsize(i); j++) v.push_back (vinit + 10*i + j);
+      maxsize = std::max (maxsize, v.size());
+      entry.Modify<double>("x") = vinit + i;
+      entry.Fill();
+    }
+  }
+  TFile f (fname);
+  TTreeIterator iter ("test", &f, verbose);
+  EXPECT_EQ (iter.GetEntries(), nfill);
+  for (auto& entry : iter) {
+    Long64_t i = entry.index();
+    const auto& v = entry.Get<std::vector<double>>("v");
+    ASSERT_EQ (v.size(), vsize(i));
+    for (size_t j = 0; j < v.size(); j++) EXPECT_EQ (v[j], vinit + 10*i + j);
+    EXPECT_EQ (entry.Get<double>("x"), vinit + i);
+  }
+  gSystem->Unlink (fname);
+}
+
+TEST(iterTests1, OptimizeBaskets) {
+  const char* fname = "iterTests1_baskets.root";
+  const Long64_t nfill = 300, cluster = 100;
+  TFile f (fname, "recreate");
+  if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+  TTreeIterator iter ("test", &f, verbose);
+  iter.SetAutoFlush (cluster).SetOptimizeBaskets (16000);
+  Int_t xsize = -1, vsize = -1;
+  for (auto& entry : iter.FillEntries(nfill)) {
+    entry["x"] = vinit + entry.index();
+    entry["v"] = std::vector<double> (10, vinit + entry.index());
+    entry.Fill();
+    if (entry.index() == cluster-2) {   // before the first cluster is flushed
+      xsize = iter.GetTree()->GetBranch("x")->GetBasketSize();
+      vsize = iter.GetTree()->GetBranch("v")->GetBasketSize();
+      EXPECT_EQ (xsize, iter.GetBufsize());
+    }
+  }
+  Int_t xopt = iter.GetTree()->GetBranch("x")->GetBasketSize();
+  Int_t vopt = iter.GetTree()->GetBranch("v")->GetBasketSize();
+  EXPECT_NE (xopt, xsize);
+  EXPECT_NE (vopt, vsize);
+  EXPECT_LT (xopt, vopt);   // v has 10 times the data
+  gSystem->Unlink (fname);
+}
+
+#ifdef USE_VALUE_ARENA
+TEST(iterTests1, SaveValues) {
+  const char* fname = "iterTests1_save.root";
+  {
+    TFile f (fname, "recreate");
+    if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+    TTreeIterator iter ("test", &f, verbose);
+    std::vector<char> saved;
+    for (auto& entry : iter.FillEntries(4)) {
+      Long64_t i = entry.index();
+      if (i == 2) {
+        EXPECT_TRUE (iter.RestoreValues (saved));   // same values as entry 0
+      } else {
+        entry["x"] = vinit + i;
+        entry["i"] = int(i+1);
+      }
+      if (i == 0) iter.SaveValues (saved);
+      if (i == 3) {
+        entry["y"] = 1.0;
+        EXPECT_FALSE (iter.RestoreValues (saved));   // a branch was added since
+      }
+      entry.Fill();
+    }
+  }
+  TFile f (fname);
+  TTreeIterator iter ("test", &f, verbose);
+  EXPECT_EQ (iter.GetEntries(), 4);
+  for (auto& entry : iter) {
+    Long64_t i = entry.index() == 2 ? 0 : entry.index();
+    EXPECT_EQ (entry.Get<double>("x"), vinit + i);
+    EXPECT_EQ (entry.Get<int>("i"), int(i+1));
+  }
+  gSystem->Unlink (fname);
+}
+#endif
+
+TEST(iterTests1, ChainIter) {
+  double sum = 0.0;
+  {
+    TFile f ("iterTests1.root");
+    if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+    TTreeIterator iter ("test", &f, verbose);
+    for (auto& entry : iter) sum += entry.Get<double>("x");
+  }
+
+  TTreeIterator iter ("test", verbose);
+  iter.Add ("iterTests1.root");
+  iter.Add ("iterTests1.root");   // the branch must be found again in the second file
+  double csum = 0.0;
+  Long64_t n = 0;
+  for (auto& entry : iter) {
+    csum += entry.Get<double>("x");
+    n++;
+  }
+  EXPECT_EQ (n, 2*nfill1);
+  EXPECT_NEAR (csum, 2*sum, 1e-9*std::abs(sum));
+
+  for (int full = 1; full >= 0; full--) {   // with the next file opened in advance, reading all, or stopping in the first file
+    TTreeIterator async ("test", verbose);
+    async.SetAsyncOpen (true);
+    async.Add ("iterTests1.root");
+    async.Add ("iterTests1.root");
+    async.Add ("iterTests1.root");
+    double asum = 0.0;
+    n = 0;
+    for (auto& entry : async) {
+      if (!full && entry.index() >= nfill1/2) break;
+      asum += entry.Get<double>("x");
+      n++;
+    }
+    if (full) {
+      EXPECT_EQ (n, 3*nfill1);
+      EXPECT_NEAR (asum, 3*sum, 1e-9*std::abs(sum));
+    } else
+      EXPECT_EQ (n, nfill1/2);
+  }
+
+  const char* cache = "iterTests1_entries.txt";
+  gSystem->Unlink (cache);
+  for (int pass = 0; pass < 2; pass++) {   // second pass gets the entry counts from the cache
+    if (pass == 1) {
+      std::ifstream in (cache);
+      std::string line;
+      int nlines = 0;
+      while (std::getline (in, line)) nlines++;
+      EXPECT_EQ (nlines, 2);   // one count per file name
+    }
+    TTreeIterator lazy ("test", verbose);
+    lazy.SetLazy (true);
+    EXPECT_TRUE (lazy.SetEntriesCache (cache));
+    lazy.Add ("iterTests1.root");
+    lazy.Add ("./iterTests1.root");
+    auto chain = dynamic_cast<TChain*>(lazy.GetTree());
+    ASSERT_TRUE (chain);
+    EXPECT_EQ (chain->GetTreeNumber(), -1);   // no file opened yet
+    if (pass == 1)
+      EXPECT_EQ (chain->GetTreeOffset()[2], 2*nfill1);   // counts from the cache
+    else
+      EXPECT_EQ (chain->GetTreeOffset()[1], TTree::kMaxEntries);
+    n = 0;
+    for (auto& entry : lazy) {
+      EXPECT_EQ (entry.Get<double>("x"), vinit + (entry.index() % nfill1) * 17);
+      n++;
+    }
+    EXPECT_EQ (n, 2*nfill1);
+  }
+  gSystem->Unlink (cache);
+}
+
+TEST(iterTests1, FriendIter) {
+  const char* fname = "iterTests1_friend.root";
+  {
+    TFile f (fname, "recreate");
+    TTreeIterator iter ("extra", &f, verbose);
+    for (auto& entry : iter.FillEntries(2*nfill1)) {
+      entry["w"] = 2.0 * entry.index();
+      entry.Fill();
+    }
+  }
+
+  TTreeIterator iter ("test", verbose);
+  iter.Add ("iterTests1.root");
+  iter.Add ("iterTests1.root");   // friend's entries line up with the whole chain, not each file
+  EXPECT_TRUE (iter.AddFriend ("extra", fname, "f"));
+  Long64_t n = 0;
+  for (auto& entry : iter) {
+    EXPECT_EQ (entry.Get<double>("x"),   vinit + (entry.index() % nfill1) * 17);
+    EXPECT_EQ (entry.Get<double>("f.w"), 2.0 * entry.index());
+    n++;
+  }
+  EXPECT_EQ (n, 2*nfill1);
+  gSystem->Unlink (fname);
+}
+
+TEST(iterTests1, IndexIter) {
+  const char* fname = "iterTests1_index.root";
+  const char* iname = "iterTests1_index.idx";
+  const Long64_t nfill = 100;
+  {
+    TFile f (fname, "recreate");
+    TTreeIterator iter ("test", &f, verbose);
+    for (auto& entry : iter.FillEntries(nfill)) {
+      Long64_t i = entry.index();
+      entry["run"]   = int(i/10);
+      entry["event"] = Long64_t((i*7)%10);
+      entry["x"]     = vinit + i;
+      entry.Fill();
+    }
+  }
+  gSystem->Unlink (iname);
+  for (int pass = 0; pass < 2; pass++) {   // second pass loads the saved index
+    TFile f (fname);
+    TTreeIterator iter ("test", &f, verbose);
+    EXPECT_TRUE (iter.BuildIndex ({"run","event"}, iname));
+    for (Long64_t i = nfill-1; i >= 0; i--) {
+      auto entry = iter.Find (int(i/10), (i*7)%10);
+      EXPECT_EQ (entry.index(), i);
+      EXPECT_EQ (entry.Get<double>("x"), vinit + i);
+    }
+    EXPECT_EQ (iter.FindEntry ({3, 10}), -1);
+    iter.GetTree()->LoadTree (0);
+    EXPECT_EQ (iter.FindEntry ({5, (55*7)%10}), 55);
+    EXPECT_EQ (iter.GetTree()->GetReadEntry(), 0);   // matched from the index, without reading the tree
+    auto missing = iter.Find (nfill, 0);
+    EXPECT_EQ (missing.index(), -1);
+    EXPECT_EQ (missing.Value<double>("x"), 0.0);
+  }
+  gSystem->Unlink (iname);
+  gSystem->Unlink (fname);
+}
+
+TEST(iterTests1, ParallelIter) {
+  TFile f ("iterTests1.root");
+  if (f.IsZombie()) { Error("iterTests1", "no file"); return; }
+
+  TTreeIterator iter ("test", &f, verbose);
+  double sum = 0.0;
+  for (auto& entry : iter) sum += entry.Get<double>("x");
+
+  std::mutex m;
+  double psum = 0.0;
+  Long64_t n = iter.ParallelForEach (4, [&](const TTreeIterator::Entry& entry) {
+    double x = entry["x"];
+    std::lock_guard<std::mutex> lock(m);
+    psum += x;
+  });
+  EXPECT_EQ (n, nfill1);
+  EXPECT_EQ (psum, sum);
+  Long64_t nstats = 0;
+  for (auto& w : iter.GetWorkerStats()) nstats += w.entries;
+  EXPECT_EQ (nstats, nfill1);
+  Info("ParallelIter1","xsum=%g",psum);
+
+  std::unique_ptr<TTreeIterator> clone = iter.CloneForThread();   // has branch "x" already set up
+  ASSERT_TRUE (clone);
+  double csum = 0.0;
+  std::thread thread ([&]() { for (auto& entry : *clone) csum += entry.Get<double>("x"); });
+  thread.join();
+  EXPECT_EQ (csum, sum);
+
+  auto add = [](double& s, double t) { s += t; };
+  auto map = [](double& s, const TTreeIterator::Entry& entry) { s += entry.Value<double>("x"); };
+  double rsum = iter.ParallelReduce (4, 0.0, map, add);
+  EXPECT_NEAR (rsum, sum, 1e-9*std::abs(sum));
+  EXPECT_EQ (rsum, iter.ParallelReduce (1, 0.0, map, add));   // combined in the same order, whatever the number of threads
+  EXPECT_EQ (iter.ParallelReduce (4, Long64_t(0), [](Long64_t& n, const TTreeIterator::Entry&) { n++; },
+                                                 [](Long64_t& n, Long64_t m) { n += m; }), nfill1);
+}
+
+TEST(iterTests1, ParallelFill) {
+  const char* fname = "iterTests1_parallel.root";
+  const Long64_t nfill = 1000;
+  {
+    TFile f (fname, "recreate");
+    ASSERT_FALSE(f.IsZombie()) << "no file";
+    TTreeIterator iter ("test", &f, verbose);
+    Long64_t n = iter.ParallelFillEntries (4, nfill, [](TTreeIterator::Entry& entry, Long64_t i) {
+      entry["i"] = i;
+      entry["x"] = vinit + i;
+      entry.Fill();
+    });
+    EXPECT_EQ (n, nfill);
+  }
+  TFile f (fname);
+  TTreeIterator iter ("test", &f, verbose);
+  EXPECT_EQ (iter.GetEntries(), nfill);
+  for (auto& entry : iter) {   // in the original order
+    EXPECT_EQ (entry.Get<Long64_t>("i"), entry.index());
+    EXPECT_EQ (entry.Get<double>("x"), vinit + entry.index());
+  }
+
+  auto swapped = [nfill](TTreeIterator::Entry& entry, Long64_t i) {   // second half creates the branches in the other order
+    if (i < nfill/2) entry["i"] = i;
+    entry["x"] = vinit + i;
+    if (i >= nfill/2) entry["i"] = i;
+    entry.Fill();
+  };
+  for (int useSchema = 0; useSchema < 2; useSchema++) {
+    TFile fs (fname, "recreate");
+    ASSERT_FALSE(fs.IsZombie()) << "no file";
+    TTreeIterator iters ("test", &fs, verbose);
+    if (useSchema) {
+      TTreeIterator::Schema schema {{"i", TTreeIterator::type<Long64_t>()}, {"x", TTreeIterator::type<double>()}};
+      EXPECT_EQ (iters.ParallelFillEntries (2, nfill, schema, swapped), nfill);
+    } else
+      EXPECT_THROW (iters.ParallelFillEntries (2, nfill, swapped), std::runtime_error);
+  }
+  gSystem->Unlink (fname);
+}
+
 // ==========================================================================================
 // iterTests2 use basic TTree operations to test writing and reading some instrumented objects
 // to see construction and destruction
@@ -472,6 +930,71 @@ TEST(iterTests4, GetIter) {
   c1.Print("xyz.pdf)");
 }
 
+TEST(iterTests4, ParallelIter) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TH2D hxy ("vxy", "vxy", 48, -6, 6, 32, -4, 4);
+  TH1D hz  ("vz",  "vz",  100, -200, 200);
+
+  TTreeIterator tree("xyz", &file);
+  for (auto& entry : tree) {
+    hxy.Fill (entry.Get<double>("vx"), entry.Get<double>("vy"));
+    hz .Fill (entry["vz"]);
+  }
+
+  TH2D pxy ("pxy", "vxy", 48, -6, 6, 32, -4, 4);
+  TH1D pz  ("pz",  "vz",  100, -200, 200);
+  Long64_t n = tree.ParallelFill (4, [](const TTreeIterator::Entry& entry, TH2D& h2, TH1D& h1) {
+    h2.Fill (entry.Get<double>("vx"), entry.Get<double>("vy"));
+    h1.Fill (entry["vz"]);
+  }, pxy, pz);
+
+  EXPECT_EQ (n, tree.GetEntries());
+  EXPECT_EQ (pxy.GetEntries(), hxy.GetEntries());
+  EXPECT_EQ (pz .GetEntries(), hz .GetEntries());
+  for (int i = 0, nb = hxy.GetNcells(); i < nb; i++) EXPECT_EQ (pxy.GetBinContent(i), hxy.GetBinContent(i));
+  for (int i = 0, nb = hz .GetNcells(); i < nb; i++) EXPECT_EQ (pz .GetBinContent(i), hz .GetBinContent(i));
+}
+
+TEST(iterTests4, ForkIter) {
+  TFile file ("xyz.root");
+  if (file.IsZombie()) return;
+
+  TH2D hxy ("vxy", "vxy", 48, -6, 6, 32, -4, 4);
+  TH1D hz  ("vz",  "vz",  100, -200, 200);
+
+  TTreeIterator tree("xyz", &file);
+  for (auto& entry : tree) {
+    hxy.Fill (entry.Get<double>("vx"), entry.Get<double>("vy"));
+    hz .Fill (entry["vz"]);
+  }
+
+  TH2D pxy ("pxy", "vxy", 48, -6, 6, 32, -4, 4);
+  TH1D pz  ("pz",  "vz",  100, -200, 200);
+  TTree out ("out", "vz copy");   // output tree, in memory
+  out.SetDirectory (nullptr);
+  double vz = 0.0;
+  out.Branch ("vz", &vz);
+  Long64_t n = tree.ForkForEach (4, [&](const TTreeIterator::Entry& entry) {
+    pxy.Fill (entry.Get<double>("vx"), entry.Get<double>("vy"));
+    pz .Fill (entry["vz"]);
+    vz = entry["vz"];
+    out.Fill();
+  }, pxy, pz, out);
+
+  EXPECT_EQ (n, tree.GetEntries());
+  EXPECT_EQ (out.GetEntries(), tree.GetEntries());
+  for (auto& entry : tree) {   // in the original order, read back into vz
+    out.GetEntry (entry.index());
+    EXPECT_EQ (vz, entry.Get<double>("vz"));
+  }
+  EXPECT_EQ (pxy.GetEntries(), hxy.GetEntries());
+  EXPECT_EQ (pz .GetEntries(), hz .GetEntries());
+  for (int i = 0, nb = hxy.GetNcells(); i < nb; i++) EXPECT_EQ (pxy.GetBinContent(i), hxy.GetBinContent(i));
+  for (int i = 0, nb = hz .GetNcells(); i < nb; i++) EXPECT_EQ (pz .GetBinContent(i), hz .GetBinContent(i));
+}
+
 TEST(iterTests4, GetAddr) {
   TFile file ("xyz.root");
   if (file.IsZombie()) return;
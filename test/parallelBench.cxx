@@ -0,0 +1,157 @@
+// Benchmark TTreeIterator::ParallelReduce on a synthetic TChain of files with skewed sizes:
+// most files are small, and every fifth file is SKEW times bigger.
+// Also compare ParallelFillEntries with FillEntries, and time a serial read of a chain of many small files,
+// where rebinding the branches on each file change is a significant part of the work.
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <benchmark/benchmark.h>
+
+#include "TFile.h"
+#include "TSystem.h"
+#include "TError.h"
+
+#include "TTreeIterator/TTreeIterator.h"
+
+#ifndef NFILES
+#define NFILES 20
+#endif
+#ifndef NSMALL
+#define NSMALL 20000
+#endif
+#ifndef SKEW
+#define SKEW 20
+#endif
+#ifndef NMANY
+#define NMANY 500
+#endif
+#ifndef NPERFILE
+#define NPERFILE 200
+#endif
+#ifndef NX
+#define NX 10
+#endif
+
+const int nfiles = NFILES;
+constexpr size_t nx = NX;
+const double vinit = 42.3;
+
+std::string FileName (int i) { return Form("test_parallel_%02d.root", i); }
+
+Long64_t FileEntries (int i) { return i%5 == 4 ? SKEW*NSMALL : NSMALL; }
+
+// Write the chain's files once per benchmark run, with small clusters so there are plenty of tasks to share out
+struct ChainFiles {
+  std::vector<std::string> bnames;
+  ChainFiles() {
+    for (size_t i=0; i<nx; i++) bnames.emplace_back (Form("x%03zu",i));
+    double v = vinit;
+    for (int i = 0; i < nfiles; i++) {
+      TFile file (FileName(i).c_str(), "recreate");
+      TTreeIterator iter ("test", &file);
+      iter.SetAutoFlush (-1000000);   // cluster every ~1MB
+      for (auto& entry : iter.FillEntries (FileEntries(i))) {
+        for (auto& b : bnames) entry[b.c_str()] = v++;
+        entry.Fill();
+      }
+    }
+  }
+  ~ChainFiles() {
+    for (int i = 0; i < nfiles; i++) gSystem->Unlink (FileName(i).c_str());
+  }
+};
+
+static void BM_ParallelChain (benchmark::State& state) {
+  static ChainFiles files;
+  int nthreads = state.range(0);
+  double imbalance = 0.0, stolen = 0.0, openmax = 0.0;
+  Long64_t nentries = 0;
+  for (auto _ : state) {
+    TTreeIterator iter ("test");
+    for (int i = 0; i < nfiles; i++) iter.Add (FileName(i).c_str());
+    double vsum = iter.ParallelReduce (nthreads, 0.0, [&](double& s, const TTreeIterator::Entry& entry) {
+      for (auto& b : files.bnames) s += std::sqrt (entry.Get<double>(b.c_str()));
+    }, [](double& s, double t) { s += t; });
+    benchmark::DoNotOptimize(vsum);
+    double tmax = 0.0, tsum = 0.0;
+    for (auto& w : iter.GetWorkerStats()) {
+      tmax = std::max (tmax, w.seconds);
+      tsum += w.seconds;
+      stolen += w.stolen;
+      openmax = std::max (openmax, w.openSeconds);
+      nentries += w.entries;
+    }
+    if (tsum > 0.0) imbalance += tmax * iter.GetWorkerStats().size() / tsum;
+  }
+  state.SetItemsProcessed (nentries);
+  state.counters["imbalance"] = imbalance / state.iterations();   // slowest thread / mean thread time
+  state.counters["stolen"]    = stolen    / state.iterations();
+  state.counters["open_ms"]   = openmax * 1000.0;   // slowest thread's CloneForThread, not included in the imbalance
+}
+BENCHMARK(BM_ParallelChain)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Fill NSMALL*SKEW entries with ParallelFillEntries, or with FillEntries for 1 thread
+static void BM_ParallelFill (benchmark::State& state) {
+  int nthreads = state.range(0);
+  const Long64_t nfill = SKEW*NSMALL;
+  std::vector<std::string> bnames;
+  for (size_t i=0; i<nx; i++) bnames.emplace_back (Form("x%03zu",i));
+  const char* fname = "test_parallel_fill.root";
+  for (auto _ : state) {
+    TFile file (fname, "recreate");
+    TTreeIterator iter ("test", &file);
+    Long64_t n = iter.ParallelFillEntries (nthreads, nfill, [&](TTreeIterator::Entry& entry, Long64_t i) {
+      double v = vinit + nx*i;
+      for (auto& b : bnames) entry[b.c_str()] = v++;
+      entry.Fill();
+    });
+    benchmark::DoNotOptimize(n);
+  }
+  state.SetItemsProcessed (state.iterations() * nfill);
+  state.SetLabel (nthreads <= 1 ? "FillEntries" : "ParallelFillEntries");
+  gSystem->Unlink (fname);
+}
+BENCHMARK(BM_ParallelFill)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// NMANY files of NPERFILE entries, each with 10*NX branches (of which we read NX)
+struct ManyFiles {
+  std::vector<std::string> bnames;
+  static std::string FileName (int i) { return Form("test_many_%03d.root", i); }
+  ManyFiles() {
+    std::vector<std::string> allnames;
+    for (size_t i=0; i<10*nx; i++) allnames.emplace_back (Form("x%03zu",i));
+    for (size_t i=0; i<nx; i++) bnames.push_back (allnames[10*i]);
+    double v = vinit;
+    for (int i = 0; i < NMANY; i++) {
+      TFile file (FileName(i).c_str(), "recreate");
+      TTreeIterator iter ("test", &file);
+      for (auto& entry : iter.FillEntries (NPERFILE)) {
+        for (auto& b : allnames) entry[b.c_str()] = v++;
+        entry.Fill();
+      }
+    }
+  }
+  ~ManyFiles() {
+    for (int i = 0; i < NMANY; i++) gSystem->Unlink (FileName(i).c_str());
+  }
+};
+
+static void BM_ManyFiles (benchmark::State& state) {
+  static ManyFiles files;
+  for (auto _ : state) {
+    TTreeIterator iter ("test");
+    for (int i = 0; i < NMANY; i++) iter.Add (ManyFiles::FileName(i).c_str(), NPERFILE);
+    double vsum = 0.0;
+    for (auto& entry : iter)
+      for (auto& b : files.bnames) vsum += entry.Get<double>(b.c_str());
+    benchmark::DoNotOptimize(vsum);
+  }
+  state.SetItemsProcessed (state.iterations() * NMANY * NPERFILE);
+  state.counters["files/s"] = benchmark::Counter (state.iterations() * NMANY, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ManyFiles)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -43,6 +43,7 @@ set +e
                                                  t 'SetBranchAddress' 'timingTests1.GetAddr'
                                                  t 'TTreeReaderValue' 'timingTests1.GetReader'
 c                                              ; t 'TTreeIterator'    'timingTests1.GetIter'
+c -DNO_BranchValue_SCALAR=1                    ; t 'any storage'      'timingTests1.GetIter'
 c -DFEWER_CHECKS=1 -DOVERRIDE_BRANCH_ADDRESS=1 ; t 'no checks'        'timingTests1.GetIter'
 
 run ./maketiming.sh
@@ -0,0 +1,52 @@
+#!/bin/bash
+# Basket size / AutoFlush matrix: fill and read the three timingTests tree shapes with each configuration
+base=$(basename "$0" .sh)
+dir=$(dirname $(readlink -e "$0" | sed 's=^/net/home/=/home/='))
+if [ $# -ge 1 ]; then
+  n="$1"
+  shift
+fi
+[ -z "$n" ] && n=1
+if [ $# -ge 1 ]; then
+  csv="$1"
+  shift
+fi
+[ -z "$csv" ] && csv="$base.csv"
+defs=("$@")
+rm -f "$csv"
+
+run() {
+  echo + "$@"
+  "$@"
+}
+
+c() {
+  run ./maketiming2.sh -DNO_BranchValue_STATS=1 -DFAST_CHECKS=1 "${defs[@]}" "$@"
+}
+
+tt() {
+  run env LABEL="$1" TIMELOG="$csv" PAD="$(printf "%$(($RANDOM % 4096))s" '' | tr ' ' .)" ./TestTiming --gtest_filter="$2"
+}
+
+t() {
+for i in $(seq $n); do
+  for test in 1 2 3; do
+    echo "==================== Test $1 timingTests$test - #$i of $n ===================="
+    tt "$1" "timingTests$test.FillIter:timingTests$test.GetIter"
+  done
+done
+}
+
+set -e
+run ./make.sh
+set +e
+
+for bufsize in 4000 16000 32000 128000 512000; do
+  c -DBUFSIZE=$bufsize                          ; t "bufsize $bufsize"
+done
+c -DOPTIMIZE_BASKETS=10000000                   ; t 'optimize 10MB'
+c -DOPTIMIZE_BASKETS=100000000                  ; t 'optimize 100MB'
+c -DAUTOFLUSH=1000 -DOPTIMIZE_BASKETS=10000000  ; t 'optimize 10MB, 1000 entries'
+
+run ./maketiming.sh
+run $(dirname "$0")/plotTimes.py "$csv"
@@ -41,6 +41,10 @@
 #ifndef VERBOSE
 #define VERBOSE 0
 #endif
+//#define BUFSIZE 32000             // TTreeIterator basket size
+//#define AUTOFLUSH 1000            // TTreeIterator AutoFlush entries (or -bytes)
+//#define OPTIMIZE_BASKETS 10000000 // TTreeIterator basket tuning memory budget
+//#define CHECKPOINT 100000         // TTreeIterator checkpoint every N entries
 
 const Long64_t nfill1 = NFILL;
 const Long64_t nfill2 = NFILL;
@@ -68,6 +72,8 @@ int LimitedEventListener::maxmsg = 10;
 #endif
 #ifdef NO_ITER
 #define FillIter DISABLED_FillIter
+#define FillIter2 DISABLED_FillIter2
+#define FillSchema DISABLED_FillSchema
 #define GetIter  DISABLED_GetIter
 #endif
 #ifdef NO_ADDR
@@ -76,6 +82,8 @@ int LimitedEventListener::maxmsg = 10;
 #endif
 #ifdef NO_FILL
 #define FillIter DISABLED_FillIter
+#define FillIter2 DISABLED_FillIter2
+#define FillSchema DISABLED_FillSchema
 #define FillAddr DISABLED_FillAddr
 #endif
 #ifdef NO_GET
@@ -93,6 +101,23 @@ Int_t ShowBranches (const TFile& file, TTree* tree, const std::string& branch_ty
   return nbranches;
 }
 
+// Apply the basket configuration (if any) to a TTreeIterator before filling
+TTreeIterator& SetupFill (TTreeIterator& iter) {
+#ifdef BUFSIZE
+  iter.SetBufsize (BUFSIZE);
+#endif
+#ifdef AUTOFLUSH
+  iter.SetAutoFlush (AUTOFLUSH);
+#endif
+#ifdef OPTIMIZE_BASKETS
+  iter.SetOptimizeBaskets (OPTIMIZE_BASKETS);
+#endif
+#ifdef CHECKPOINT
+  iter.SetCheckpoint (CHECKPOINT);
+#endif
+  return iter;
+}
+
 class StartTimer : public TStopwatch {
   TTree* fTree = 0;
   bool fFill = false;
@@ -158,6 +183,7 @@ TEST(timingTests1, FillIter) {
   for (size_t i=0; i<nx1; i++) bnames.emplace_back (Form("x%03zu",i));
 
   TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
   StartTimer timer (iter.GetTree(), true);
   double v = vinit;
   for (auto& entry : iter.FillEntries(nfill1)) {
@@ -168,6 +194,26 @@ TEST(timingTests1, FillIter) {
   EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill1), v);
 }
 
+TEST(timingTests1, FillSchema) {
+  TFile file ("test_timing1.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  TTreeIterator::Schema schema;
+  schema.reserve(nx1);
+  for (size_t i=0; i<nx1; i++) schema.emplace_back (Form("x%03zu",i), TTreeIterator::type<double>());
+
+  TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
+  StartTimer timer (iter.GetTree(), true);
+  double v = vinit;
+  for (auto& entry : iter.FillEntries(nfill1, schema)) {
+    for (size_t i=0; i<nx1; i++) entry.SetAt(i, v++);
+    entry.Fill();
+  }
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type1, "filled");
+  EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill1), v);
+}
+
 TEST(timingTests1, GetIter) {
   TFile file ("test_timing1.root");
   ASSERT_FALSE(file.IsZombie()) << "no file";
@@ -375,6 +421,7 @@ TEST(timingTests2, FillIter) {
   ASSERT_FALSE(file.IsZombie()) << "no file";
 
   TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
   StartTimer timer (iter.GetTree(), true, nx2);
   double v = vinit;
   for (auto& entry : iter.FillEntries(nfill2)) {
@@ -387,6 +434,25 @@ TEST(timingTests2, FillIter) {
   EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill2*nx2), v);
 }
 
+TEST(timingTests2, FillSchema) {
+  ASSERT_EQ (sizeof(MyStruct::x)/sizeof(MyStruct::x[0]), nx2);
+  TFile file ("test_timing2.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
+  StartTimer timer (iter.GetTree(), true, nx2);
+  double v = vinit;
+  MyStruct M;
+  for (auto& entry : iter.FillEntries(nfill2, {{"M", TTreeIterator::type<MyStruct>()}})) {
+    for (auto& x : M.x) x = v++;
+    entry.SetAt(0, M);
+    entry.Fill();
+  }
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type2, "filled");
+  EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill2*nx2), v);
+}
+
 TEST(timingTests2, GetIter) {
   ASSERT_EQ (sizeof(MyStruct::x)/sizeof(MyStruct::x[0]), nx2);
   TFile file ("test_timing2.root");
@@ -505,6 +571,7 @@ TEST(timingTests3, FillIter) {
   ASSERT_FALSE(file.IsZombie()) << "no file";
 
   TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
   StartTimer timer (iter.GetTree(), true, nx3);
   double v = vinit;
   for (auto& entry : iter.FillEntries(nfill3)) {
@@ -517,6 +584,24 @@ TEST(timingTests3, FillIter) {
   EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill3*nx3), v);
 }
 
+TEST(timingTests3, FillIter2) {
+  TFile file ("test_timing3.root", "recreate");
+  ASSERT_FALSE(file.IsZombie()) << "no file";
+
+  TTreeIterator iter ("test", verbose);
+  SetupFill (iter);
+  StartTimer timer (iter.GetTree(), true, nx3);
+  double v = vinit;
+  for (auto& entry : iter.FillEntries(nfill3)) {
+    auto& vx = entry.Modify<std::vector<double>>("vx");   // reuse the branch's buffer
+    vx.clear();
+    for (size_t i=0; i<nx3; i++) vx.push_back(v++);
+    entry.Fill();
+  }
+  Int_t nbranches = ShowBranches (file, iter.GetTree(), branch_type3, "filled");
+  EXPECT_FLOAT_EQ (vinit+double(nbranches*nfill3*nx3), v);
+}
+
 TEST(timingTests3, GetIter) {
   TFile file ("test_timing3.root");
   ASSERT_FALSE(file.IsZombie()) << "no file";